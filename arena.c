@@ -0,0 +1,145 @@
+/**@file arena.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Arena holding the buffers of all the lines in one huge page mapping
+ *
+ * Instead of malloc'ing the decoder state, message and sample buffers of
+ * every line, all of them are carved out of one anonymous mapping. Every
+ * line gets the same stride, laid out as:				<BR>
+ *      struct callerid_state | cid_data | ring | rs | work | hist		<BR>
+ * each region starting on a cache line (ARENA_ALIGN), so that the hot state
+ * of a line never shares a line with the samples of its neighbour.
+ *
+ * The mapping is backed by reserved huge pages (MAP_HUGETLB) when the system
+ * has them, else by transparent huge pages (madvise), so thousands of lines
+ * need a few TLB entries and the heap is never fragmented by them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+/**@brief Round up a size to a multiple of a power of 2 */
+static size_t round_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+/**@brief Map an arena for nlines lines.
+ *
+ * The memory is zeroed, as calloc() would do.
+ *
+ * @param nlines no. of lines
+ * @param ring_len captured samples per line
+ * @param rs_len resampled samples per line, 0 if there is no resampling
+ * @param work_len scratch samples of the demodulator per line
+ * @param hist_len history samples per line, 0 without a control socket
+ *
+ * @return Returns a pointer to a malloc'd line_arena, or NULL on error.
+ */
+line_arena *line_arena_new(int nlines, int ring_len, int rs_len, int work_len, int hist_len)
+{
+    line_arena *a;
+    size_t off;
+
+    if (nlines <= 0 || nlines > ARENA_MAX_LINES || ring_len < 0 || rs_len < 0 || work_len < 0 ||
+	hist_len < 0)
+	return NULL;
+    if (!(a = calloc(1, sizeof(*a))))
+	return NULL;
+
+    a->nlines = nlines;
+    a->ring_len = ring_len;
+    a->rs_len = rs_len;
+    a->work_len = work_len;
+    a->hist_len = hist_len;
+
+    off = round_up(sizeof(struct callerid_state), ARENA_ALIGN);
+    a->off_data = off;
+    off += round_up(sizeof(cid_data), ARENA_ALIGN);
+    a->off_ring = off;
+    off += round_up(ring_len * sizeof(short), ARENA_ALIGN);
+    a->off_rs = off;
+    off += round_up(rs_len * sizeof(short), ARENA_ALIGN);
+    a->off_work = off;
+    off += round_up(work_len * sizeof(short), ARENA_ALIGN);
+    a->off_hist = off;
+    off += round_up(hist_len * sizeof(short), ARENA_ALIGN);
+    a->stride = off;
+    a->size = round_up(a->stride * nlines, ARENA_HUGE_PAGE);
+
+#ifdef MAP_HUGETLB
+    a->base = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    a->huge = (a->base != MAP_FAILED);
+#else
+    a->base = MAP_FAILED;
+#endif
+    if (a->base == MAP_FAILED) {                // No reserved huge pages
+	a->base = mmap(NULL, a->size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (a->base == MAP_FAILED) {
+	    free(a);
+	    return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(a->base, a->size, MADV_HUGEPAGE);
+#endif
+    }
+    return a;
+}
+
+/**@brief Get the buffers of a line.
+ *
+ * @param a arena
+ * @param line line number, 0 to nlines - 1
+ * @param slot buffers of the line
+ *
+ * @return 0 if successful else -1 if the line is not in the arena
+ */
+int line_arena_slot(line_arena * a, int line, line_slot * slot)
+{
+    unsigned char *p;
+
+    if (line < 0 || line >= a->nlines)
+	return -1;
+
+    p = a->base + (size_t) line * a->stride;
+    slot->cs = (struct callerid_state *) p;
+    slot->data = (cid_data *) (p + a->off_data);
+    slot->ring = (short *) (p + a->off_ring);
+    slot->rs = a->rs_len ? (short *) (p + a->off_rs) : NULL;
+    slot->work = (short *) (p + a->off_work);
+    slot->hist = a->hist_len ? (short *) (p + a->off_hist) : NULL;
+    return 0;
+}
+
+/**@brief Print the layout and the footprint of the arena.
+ *
+ * @param a arena
+ * @param fp stream to print to
+ */
+void line_arena_report(const line_arena * a, FILE * fp)
+{
+    fprintf(fp, "Arena: %d lines x %zu bytes = %zu bytes in %zu %s pages\n",
+	    a->nlines, a->stride, a->size, a->size / ARENA_HUGE_PAGE,
+	    a->huge ? "huge" : "transparent huge");
+    fprintf(fp, "       state %zu, data %zu, ring %zu, rs %zu, work %zu, hist %zu bytes per line\n",
+	    a->off_data, a->off_ring - a->off_data, a->off_rs - a->off_ring,
+	    a->off_work - a->off_rs, a->off_hist - a->off_work, a->stride - a->off_hist);
+}
+
+/**@brief Unmap the arena.
+ *
+ * @param a arena
+ */
+void line_arena_free(line_arena * a)
+{
+    if (a) {
+	munmap(a->base, a->size);
+	free(a);
+    }
+}
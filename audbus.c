@@ -0,0 +1,319 @@
+/**@file audbus.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Shared memory bus publishing the captured periods to other processes
+ *
+ * Only one process can open the hw device of the sound card, and the
+ * recorders and the voice analytics need the audio of the line too. The
+ * capture of cid_fsk publishes it on a bus instead: a POSIX shared memory
+ * object holding the last AUDBUS_SLOTS periods,				<BR>
+ *      struct audbus_header | period 0 | period 1 | ...		<BR>
+ * pcm_read() reads every period straight into its slot, and the decoder
+ * and every reader process use it in place, so a sample is copied once, by
+ * the driver.
+ *
+ * The writer never waits for the readers. Slot n % AUDBUS_SLOTS holds period
+ * n, its seq is n + 1 once published and 0 while it is captured into. A
+ * reader checks seq before and after using a period (a sequence lock): a
+ * reader that fell more than AUDBUS_SLOTS periods behind finds it changed,
+ * counts an overrun and jumps ahead. The readers sleep on a futex the
+ * writer wakes at every period.
+ *
+ * The bus is published only while cid_fsk captures, so the writer needs
+ * the continuous capture of the control socket (-S): with the rings it
+ * would only capture the window after a ring.
+ *
+ * The header counts the processes attached. The writer unlinks the name
+ * when it leaves, the memory lives until the last reader unmaps it, and
+ * the readers see closed once they read the last period.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "audbus.h"
+
+/**@brief Wait on a futex of the bus, at most AUDBUS_WAIT_MS. */
+static void bus_wait(uint32_t * addr, uint32_t val)
+{
+    struct timespec ts = { 0, AUDBUS_WAIT_MS * 1000000L };
+
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+/**@brief Wake all the readers waiting on a futex of the bus. */
+static void bus_wake(uint32_t * addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**@brief Name of the shared memory object, starting with a '/'.
+ *
+ * @return 0 if successful else -1 if the name is too long
+ */
+static int bus_name(audbus * b, const char *name)
+{
+    int n = snprintf(b->name, sizeof(b->name), "%s%s", (*name == '/') ? "" : "/", name);
+
+    return (n < (int) sizeof(b->name)) ? 0 : -1;
+}
+
+/**@brief Create a bus and publish its name.
+ *
+ * A bus of the same name is not taken over, its writer may be alive: it
+ * is replaced only when asked, e.g. when left by a writer that crashed.
+ *
+ * @param name name of the bus
+ * @param rate sampling rate
+ * @param channels channels of a frame
+ * @param bits bits of a sample
+ * @param period_bytes bytes of a period
+ * @param replace 1 to replace a bus of the same name
+ *
+ * @return Returns a pointer to a malloc'd audbus, or NULL on error (errno is
+ * EEXIST if the bus exists and is not replaced).
+ */
+audbus *audbus_create(const char *name, int rate, int channels, int bits, uint32_t period_bytes,
+		      int replace)
+{
+    struct audbus_header *h;
+    size_t data_off = (sizeof(*h) + AUDBUS_ALIGN - 1) & ~(size_t) (AUDBUS_ALIGN - 1);
+    audbus *b;
+    void *p;
+    int fd, err;
+
+    if (!(b = calloc(1, sizeof(*b))))
+	return NULL;
+    if (bus_name(b, name))
+	goto fail;
+    b->size = data_off + (size_t) AUDBUS_SLOTS * period_bytes;
+
+    if (replace)
+	shm_unlink(b->name);
+    if ((fd = shm_open(b->name, O_RDWR | O_CREAT | O_EXCL, 0660)) < 0)
+	goto fail;
+    if (ftruncate(fd, b->size) ||
+	(p = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+	close(fd);
+	shm_unlink(b->name);
+	goto fail;
+    }
+    close(fd);
+
+    h = b->hdr = p;
+    b->data = (unsigned char *) p + data_off;
+    b->writer = 1;
+    h->version = AUDBUS_VERSION;
+    h->rate = rate;
+    h->channels = channels;
+    h->bits = bits;
+    h->period_bytes = period_bytes;
+    h->data_off = data_off;
+    h->refs = 1;
+    __atomic_store_n(&h->magic, AUDBUS_MAGIC, __ATOMIC_RELEASE);        // Ready to attach
+    return b;
+
+  fail:
+    err = errno;
+    free(b);
+    errno = err;
+    return NULL;
+}
+
+/**@brief Buffer of the next period, to capture into.
+ *
+ * The readers skip the slot until audbus_publish().
+ *
+ * @param b bus of the writer
+ *
+ * @return Returns a pointer to period_bytes bytes in the bus.
+ */
+void *audbus_claim(audbus * b)
+{
+    struct audbus_slot *s = &b->hdr->slot[b->next % AUDBUS_SLOTS];
+
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);            // Before the new samples
+    return b->data + (b->next % AUDBUS_SLOTS) * (size_t) b->hdr->period_bytes;
+}
+
+/**@brief Publish the period claimed.
+ *
+ * @param b bus of the writer
+ * @param frames frames of the period
+ * @param t_ns timestamp of the period
+ * @param lost frames lost by an xrun before the period
+ */
+void audbus_publish(audbus * b, uint32_t frames, int64_t t_ns, uint32_t lost)
+{
+    struct audbus_header *h = b->hdr;
+    struct audbus_slot *s = &h->slot[b->next % AUDBUS_SLOTS];
+
+    s->frames = frames;
+    s->t_ns = t_ns;
+    s->lost = lost;
+    b->next++;
+    __atomic_store_n(&s->seq, b->next, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->head, b->next, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->wake, (uint32_t) b->next, __ATOMIC_RELEASE);
+    bus_wake(&h->wake);
+}
+
+/**@brief Attach to a bus as a reader.
+ *
+ * The reader starts at the next period published.
+ *
+ * @param name name of the bus
+ *
+ * @return Returns a pointer to a malloc'd audbus, or NULL on error.
+ */
+audbus *audbus_attach(const char *name)
+{
+    struct audbus_header *h;
+    struct stat sb;
+    audbus *b;
+    void *p;
+    int fd;
+
+    if (!(b = calloc(1, sizeof(*b))))
+	return NULL;
+    if (bus_name(b, name) || (fd = shm_open(b->name, O_RDWR, 0)) < 0)
+	goto fail;
+    if (fstat(fd, &sb) || sb.st_size < (off_t) sizeof(*h) ||
+	(p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+	close(fd);
+	goto fail;
+    }
+    close(fd);
+
+    h = b->hdr = p;
+    b->size = sb.st_size;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != AUDBUS_MAGIC ||
+	h->version != AUDBUS_VERSION ||
+	h->data_off + (size_t) AUDBUS_SLOTS * h->period_bytes > b->size) {
+	munmap(p, b->size);
+	goto fail;
+    }
+    b->data = (unsigned char *) p + h->data_off;
+    __atomic_add_fetch(&h->refs, 1, __ATOMIC_ACQ_REL);
+    b->next = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+    return b;
+
+  fail:
+    free(b);
+    return NULL;
+}
+
+/**@brief Wait for the next period.
+ *
+ * A reader more than AUDBUS_SLOTS periods behind jumps to the middle of the
+ * bus, the periods skipped are counted as overruns.
+ *
+ * @param b bus of the reader
+ * @param slot set to the slot of the period, its frames and timestamp
+ *
+ * @return Returns a pointer to the period in the bus, valid until
+ * audbus_done(), or NULL if none came within AUDBUS_WAIT_MS or once the
+ * writer closed the bus (hdr->closed).
+ */
+const void *audbus_next(audbus * b, const struct audbus_slot **slot)
+{
+    struct audbus_header *h = b->hdr;
+    struct audbus_slot *s;
+    uint64_t head;
+    uint32_t wake;
+    int waited = 0;
+
+    for (;;) {
+	wake = __atomic_load_n(&h->wake, __ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+	if (head <= b->next) {
+	    if (waited++ || __atomic_load_n(&h->closed, __ATOMIC_ACQUIRE))
+		return NULL;
+	    bus_wait(&h->wake, wake);
+	    continue;
+	}
+	if (head - b->next >= AUDBUS_SLOTS) {           // Overwritten, keep up
+	    b->overruns += head - AUDBUS_SLOTS / 2 - b->next;
+	    b->next = head - AUDBUS_SLOTS / 2;
+	}
+	s = &h->slot[b->next % AUDBUS_SLOTS];
+	if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == b->next + 1)
+	    break;
+	b->overruns++;                                  // Captured into meanwhile
+	b->next++;
+    }
+    *slot = s;
+    return b->data + (b->next % AUDBUS_SLOTS) * (size_t) h->period_bytes;
+}
+
+/**@brief Release the period read.
+ *
+ * @param b bus of the reader
+ *
+ * @return 0 if the period was intact while it was used, else -1 if the
+ * writer captured into it meanwhile (an overrun)
+ */
+int audbus_done(audbus * b)
+{
+    struct audbus_slot *s = &b->hdr->slot[b->next % AUDBUS_SLOTS];
+    int ok;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);            // After the samples used
+    ok = (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == b->next + 1);
+    b->next++;
+    if (!ok)
+	b->overruns++;
+    return ok ? 0 : -1;
+}
+
+/**@brief Print the state of the bus.
+ *
+ * @param b bus
+ * @param fp stream to print to
+ */
+void audbus_report(const audbus * b, FILE * fp)
+{
+    const struct audbus_header *h = b->hdr;
+
+    fprintf(fp, "Audio bus %s: %d Hz, %d ch, %d bit, %u bytes per period, %d periods, "
+	    "%u attached, %llu published", b->name, h->rate, h->channels, h->bits,
+	    h->period_bytes, AUDBUS_SLOTS, __atomic_load_n(&h->refs, __ATOMIC_RELAXED),
+	    (unsigned long long) __atomic_load_n(&h->head, __ATOMIC_RELAXED));
+    if (!b->writer)
+	fprintf(fp, ", %llu overruns", (unsigned long long) b->overruns);
+    fprintf(fp, "\n");
+}
+
+/**@brief Leave the bus, the writer closes it.
+ *
+ * @param b bus
+ */
+void audbus_close(audbus * b)
+{
+    struct audbus_header *h;
+
+    if (!b)
+	return;
+    h = b->hdr;
+    if (b->writer) {
+	__atomic_store_n(&h->closed, 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&h->wake, 1, __ATOMIC_RELEASE);
+	bus_wake(&h->wake);
+	shm_unlink(b->name);
+    }
+    __atomic_sub_fetch(&h->refs, 1, __ATOMIC_ACQ_REL);
+    munmap(h, b->size);
+    free(b);
+}
@@ -0,0 +1,194 @@
+/**@file canary.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Synthetic canary spills measuring the latency of the decoder
+ *
+ * Every period a spill is synthesized on a virtual line (CANARY_LINE), at
+ * the capture rate, and run block by block by its own thread through a
+ * pipeline built from the spec of the real line, then the same sinks. The
+ * blocks are paced by the clock, not by the capture, so the canaries keep
+ * flowing while the line is idle. The canaries are tagged: their
+ * number is CANARY_PREFIX followed by the sequence no., their name is
+ * CANARY_NAME and their call records are on CANARY_LINE, so the sinks can
+ * filter them. The time from the injection of the first sample to the
+ * delivery of the decoded message goes in a histogram of power of 2 ms
+ * buckets, and is checked against the latency budget.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "fskmodem.h"
+#include "ciddeco.h"
+#include "canary.h"
+
+/**@brief Current time in micro seconds */
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**@brief Initialize the canary injector.
+ *
+ * The first canary is sent right away.
+ *
+ * @param c canary injector
+ * @param period_ms time between two canaries
+ * @param budget_ms latency budget, injection to delivery
+ * @param rate sampling rate of the virtual line, the one of the capture
+ * @param baud bit rate of the spills
+ *
+ * @return 0 if successful else -1 if error
+ */
+int canary_init(canary * c, int period_ms, int budget_ms, int rate, int baud)
+{
+    memset(c, 0, sizeof(*c));
+    if (period_ms <= 0 || budget_ms <= 0 ||
+	cid_tx_init(&c->tx, 1, rate, baud, CID_SIG_V23, CANARY_AMP))
+	return -1;
+
+    c->period_ms = period_ms;
+    c->budget_ms = budget_ms;
+    c->next_us = now_us();
+    return 0;
+}
+
+/**@brief Render the next block of the virtual line.
+ *
+ * Starts a new canary when its time has come, and gives the lost one up
+ * when it is not delivered CANARY_TIMEOUT_MS after its spill.
+ *
+ * @param c canary injector
+ * @param samples block to fill, at the rate of the virtual line
+ * @param n no. of samples in the block
+ *
+ * @return no. of samples to decode, 0 if the virtual line is idle, -1 if
+ * the current canary was lost and the decoder of the line must be reset
+ */
+int canary_render(canary * c, short *samples, int n)
+{
+    unsigned char msg[TX_MAX_MSG];
+    char number[16], date_time[9];
+    long long now = now_us();
+    time_t t;
+    struct tm tm;
+    int len;
+
+    switch (c->state) {
+    case CANARY_IDLE:
+	if (now < c->next_us)
+	    return 0;
+
+	t = time(NULL);
+	localtime_r(&t, &tm);
+	strftime(date_time, sizeof(date_time), "%m%d%H%M", &tm);
+	snprintf(number, sizeof(number), CANARY_PREFIX "%07u", ++c->seq % 10000000);
+	if ((len = cid_msg_build(msg, MDMF, date_time, number, CANARY_NAME)) < 0 ||
+	    cid_tx_ring(&c->tx, 0, c->tx.now, 0, msg, len))
+	    return 0;
+
+	c->state = CANARY_SEND;
+	c->tail = CANARY_TAIL_MS * c->tx.rate / 1000;
+	c->injected_us = now;
+	c->next_us = now + c->period_ms * 1000LL;
+	c->sent++;
+	/* fall through */
+    case CANARY_SEND:
+	if (!cid_tx_render(&c->tx, samples, n) && (c->tail -= n) <= 0) {
+	    c->state = CANARY_WAIT;
+	    c->sent_us = now;
+	}
+	return n;
+
+    case CANARY_WAIT:
+	if (now - c->sent_us < CANARY_TIMEOUT_MS * 1000LL)
+	    return 0;
+	canary_lost(c);
+	return -1;
+    }
+    return 0;
+}
+
+/**@brief Check a decoded message of the virtual line.
+ *
+ * @param c canary injector
+ * @param number decoded number
+ *
+ * @return latency of the canary in micro seconds, or -1 if the number is not
+ * the one of the current canary
+ */
+long long canary_delivered(canary * c, const char *number)
+{
+    char expect[16];
+    long long lat;
+    int b;
+
+    snprintf(expect, sizeof(expect), CANARY_PREFIX "%07u", c->seq % 10000000);
+    if (c->state == CANARY_IDLE || strcmp(number, expect))
+	return -1;
+
+    lat = now_us() - c->injected_us;
+    for (b = 0; b < CANARY_BUCKETS - 1 && (1LL << b) * 1000 <= lat; b++);
+    c->hist[b]++;
+    c->delivered++;
+    if (lat > c->budget_ms * 1000LL)
+	c->over_budget++;
+    if (lat > c->max_us)
+	c->max_us = lat;
+    c->state = CANARY_IDLE;
+    return lat;
+}
+
+/**@brief Count the current canary as lost.
+ *
+ * @param c canary injector
+ */
+void canary_lost(canary * c)
+{
+    if (c->state != CANARY_IDLE) {
+	c->lost++;
+	c->state = CANARY_IDLE;
+    }
+}
+
+/**@brief Latency below which a fraction of the canaries were delivered.
+ *
+ * @param c canary injector
+ * @param p fraction, 0.5 for the median
+ *
+ * @return upper bound of the bucket in ms, 0 if nothing was delivered
+ */
+int canary_percentile(const canary * c, double p)
+{
+    unsigned int sum = 0;
+    int b;
+
+    if (!c->delivered)
+	return 0;
+    for (b = 0; b < CANARY_BUCKETS - 1; b++)
+	if ((sum += c->hist[b]) >= p * c->delivered)
+	    break;
+    return 1 << b;
+}
+
+/**@brief Print the latency histogram.
+ *
+ * @param c canary injector
+ * @param fp stream to print to
+ */
+void canary_report(const canary * c, FILE * fp)
+{
+    int b;
+
+    fprintf(fp, "Canaries: %u sent, %u delivered, %u lost, %u over the %d ms budget, max %.1f ms\n",
+	    c->sent, c->delivered, c->lost, c->over_budget, c->budget_ms, c->max_us / 1000.0);
+    for (b = 0; b < CANARY_BUCKETS; b++)
+	if (c->hist[b])
+	    fprintf(fp, "  %s %5d ms : %u\n", (b < CANARY_BUCKETS - 1) ? "<" : ">=",
+		    (b < CANARY_BUCKETS - 1) ? 1 << b : 1 << (b - 1), c->hist[b]);
+}
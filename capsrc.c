@@ -0,0 +1,258 @@
+/**@file capsrc.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Timestamps of the sound card capture, recorded and replayed
+ *
+ * A wav file only has the samples. What made a line fail in production is
+ * often how they came: blocks late, xruns, samples lost. After every block
+ * read, the capture takes pcm_get_htimestamp(): the time the hardware
+ * pointer was last updated, and the frames still in the buffer then. The
+ * card captured (t - t_prev) * rate frames between two blocks; those read
+ * or still in the buffer are:						<BR>
+ *      frames + avail - avail_prev					<BR>
+ * and the rest were lost by an xrun (pcm_read() restarts the capture by
+ * itself, silently).
+ *
+ * A capture recording keeps the blocks with their timestamps, and the
+ * start, stop and xrun events:						<BR>
+ *      struct capsrc_header | struct capsrc_event [bytes] ...		<BR>
+ * appended as the capture goes. The replay delivers the blocks at the
+ * recorded times, relative to the first event, and the rings at the times
+ * of the start events, so that the decoder sees the same pattern as in
+ * production, and the same latency and overrun bugs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "capsrc.h"
+
+/**@brief Current time of CLOCK_MONOTONIC in nano seconds.
+ *
+ * The clock of the timestamps, the PCM is opened with PCM_MONOTONIC.
+ */
+int64_t capsrc_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**@brief Start the clock of a capture.
+ *
+ * @param c clock
+ * @param rate sampling rate
+ * @param period_size frames of a period, half of it is timestamp jitter
+ */
+void capsrc_clock_init(capsrc_clock * c, int rate, int period_size)
+{
+    memset(c, 0, sizeof(*c));
+    c->rate = rate;
+    c->min_gap = period_size / 2;
+}
+
+/**@brief Frames lost since the previous block.
+ *
+ * @param c clock
+ * @param t_ns timestamp taken after reading the block
+ * @param avail frames left in the buffer at t_ns
+ * @param frames frames of the block
+ *
+ * @return no. of frames lost before the block, 0 for the first block
+ */
+uint32_t capsrc_clock_lost(capsrc_clock * c, int64_t t_ns, uint32_t avail, uint32_t frames)
+{
+    int64_t lost = 0;
+
+    if (c->t_ns && t_ns > c->t_ns) {
+	lost = ((t_ns - c->t_ns) * c->rate + 500000000LL) / 1000000000LL -
+	    ((int64_t) frames + avail - c->avail);
+	if (lost < c->min_gap)
+	    lost = 0;
+	else {
+	    c->xruns++;
+	    c->lost += lost;
+	}
+    }
+    c->t_ns = t_ns;
+    c->avail = avail;
+    return lost;
+}
+
+/**@brief Open a capture recording to append to.
+ *
+ * A new recording gets the header, an existing one must have been recorded
+ * with the same parameters.
+ *
+ * @param path recording, created if needed
+ * @param rate sampling rate
+ * @param channels channels of a frame
+ * @param bits bits of a sample
+ * @param period_size frames of a period
+ * @param period_count periods of the buffer
+ *
+ * @return Returns a pointer to a malloc'd capsrc_writer, or NULL on error.
+ */
+capsrc_writer *capsrc_create(const char *path, int rate, int channels, int bits,
+			     int period_size, int period_count)
+{
+    struct capsrc_header h, old;
+    capsrc_writer *w;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = CAPSRC_MAGIC;
+    h.version = CAPSRC_VERSION;
+    h.rate = rate;
+    h.channels = channels;
+    h.bits = bits;
+    h.period_size = period_size;
+    h.period_count = period_count;
+
+    if (!(w = calloc(1, sizeof(*w))))
+	return NULL;
+    if (!(w->fp = fopen(path, "a+b")))
+	goto fail;
+    fseek(w->fp, 0, SEEK_END);
+    if (ftell(w->fp) == 0) {
+	if (fwrite(&h, sizeof(h), 1, w->fp) != 1 || fflush(w->fp))
+	    goto fail;
+    } else {
+	rewind(w->fp);
+	if (fread(&old, sizeof(old), 1, w->fp) != 1 || memcmp(&old, &h, sizeof(h)))
+	    goto fail;
+	fseek(w->fp, 0, SEEK_END);
+    }
+    return w;
+
+  fail:
+    if (w->fp)
+	fclose(w->fp);
+    free(w);
+    return NULL;
+}
+
+/**@brief Append an event.
+ *
+ * The events are buffered, and written at the stop and xrun events.
+ *
+ * @param w recording
+ * @param type CAPSRC_*
+ * @param frames frames of the block, or lost
+ * @param t_ns time of the event
+ * @param avail frames left in the buffer at t_ns
+ * @param data bytes of the block, NULL if none
+ * @param bytes no. of bytes
+ *
+ * @return 0 if successful else -1 if error
+ */
+int capsrc_put(capsrc_writer * w, uint32_t type, uint32_t frames, int64_t t_ns, uint32_t avail,
+	       const void *data, uint32_t bytes)
+{
+    struct capsrc_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.frames = frames;
+    ev.t_ns = t_ns;
+    ev.avail = avail;
+    ev.bytes = data ? bytes : 0;
+
+    if (fwrite(&ev, sizeof(ev), 1, w->fp) != 1 ||
+	(ev.bytes && fwrite(data, ev.bytes, 1, w->fp) != 1))
+	return -1;
+    return (type == CAPSRC_STOP || type == CAPSRC_XRUN) ? fflush(w->fp) : 0;
+}
+
+/**@brief Close a capture recording written.
+ *
+ * @param w recording
+ */
+void capsrc_close(capsrc_writer * w)
+{
+    if (w) {
+	fclose(w->fp);
+	free(w);
+    }
+}
+
+/**@brief Open a capture recording to replay.
+ *
+ * @param path recording
+ *
+ * @return Returns a pointer to a malloc'd capsrc_reader, or NULL on error.
+ */
+capsrc_reader *capsrc_open(const char *path)
+{
+    capsrc_reader *r;
+
+    if (!(r = calloc(1, sizeof(*r))))
+	return NULL;
+    if (!(r->fp = fopen(path, "rb")) || fread(&r->hdr, sizeof(r->hdr), 1, r->fp) != 1 ||
+	r->hdr.magic != CAPSRC_MAGIC || r->hdr.version != CAPSRC_VERSION) {
+	if (r->fp)
+	    fclose(r->fp);
+	free(r);
+	return NULL;
+    }
+    return r;
+}
+
+/**@brief Read the next event.
+ *
+ * @param r recording
+ * @param data bytes of the event
+ * @param max size of data
+ *
+ * @return 1 if an event was read, 0 at the end, -1 if the recording is
+ * corrupt
+ */
+int capsrc_next(capsrc_reader * r, void *data, uint32_t max)
+{
+    if (fread(&r->ev, sizeof(r->ev), 1, r->fp) != 1)
+	return 0;
+    if (r->ev.type < CAPSRC_START || r->ev.type > CAPSRC_STOP || r->ev.bytes > max ||
+	(r->ev.bytes && fread(data, r->ev.bytes, 1, r->fp) != 1))
+	return -1;
+
+    if (!r->rec_t0) {
+	r->rec_t0 = r->ev.t_ns;
+	r->play_t0 = capsrc_now();
+    }
+    return 1;
+}
+
+/**@brief Wait for the time of the event read.
+ *
+ * The time is relative to the first event of the recording. The events the
+ * replay is already late for are not waited for, the lateness is kept.
+ *
+ * @param r recording
+ */
+void capsrc_wait(capsrc_reader * r)
+{
+    int64_t at = r->play_t0 + (r->ev.t_ns - r->rec_t0), late;
+    struct timespec ts;
+
+    ts.tv_sec = at / 1000000000LL;
+    ts.tv_nsec = at % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    if ((late = capsrc_now() - at) > r->late_ns)
+	r->late_ns = late;
+}
+
+/**@brief Close a capture recording replayed.
+ *
+ * @param r recording
+ */
+void capsrc_free(capsrc_reader * r)
+{
+    if (r) {
+	fclose(r->fp);
+	free(r);
+    }
+}
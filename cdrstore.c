@@ -0,0 +1,429 @@
+/**@file cdrstore.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Append-only store of the decoded calls
+ *
+ * Records are fixed size and only appended, in the order of the calls, to
+ * segment files of CDR_SEG_RECORDS records. Records are written in batches
+ * of CDR_BATCH. When a segment is full it is sealed: an index of the
+ * records sorted by the hash of the number is written next to it, and
+ * both files are memory-mapped for queries. A query skips the segments
+ * outside of its time range (the earliest and the latest call of the
+ * segment, kept after its index, as the clock may be set back), binary
+ * searches the index of the sealed ones and scans the active one.
+ *
+ * Only the last segment is appended to. On open, every other segment is
+ * sealed whatever its size, so that a segment left short by a crash (or by
+ * a store restored in part) is still indexed and queried. A store opened
+ * for queries only changes none of the files.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cdrstore.h"
+
+static uint64_t cdr_key(const char *number)
+{
+    uint64_t h = 14695981039346656037ULL;       // FNV-1a on the number field
+    int i;
+
+    for (i = 0; i < CDR_NUM_LEN && number[i]; i++)
+	h = (h ^ (unsigned char) number[i]) * 1099511628211ULL;
+    return h;
+}
+
+static void seg_path(cdr_store * st, unsigned int seq, const char *ext, char *path)
+{
+    snprintf(path, CDR_PATH_LEN, "%s/%08u.%s", st->dir, seq, ext);
+}
+
+/**@brief Map a whole file read-only, NULL if empty or missing */
+static const void *map_file(const char *path, size_t * size)
+{
+    struct stat sb;
+    void *p;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+	return NULL;
+    if (fstat(fd, &sb) == -1 || sb.st_size == 0) {
+	close(fd);
+	return NULL;
+    }
+    p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+	return NULL;
+    *size = sb.st_size;
+    return p;
+}
+
+static int index_cmp(const void *a, const void *b)
+{
+    const struct cdr_index *x = a, *y = b;
+
+    if (x->key != y->key)
+	return (x->key > y->key) - (x->key < y->key);
+    return (x->rec > y->rec) - (x->rec < y->rec);
+}
+
+/**@brief Seal a full segment: write its number index and map both files
+ *
+ * The index file holds the index entries sorted by key, then the time
+ * range of the segment. A read-only store builds a missing index in memory
+ * and writes nothing.
+ */
+static int cdr_seal(cdr_store * st, struct cdr_seg *s)
+{
+    char path[CDR_PATH_LEN], tmp[CDR_PATH_LEN + 4];
+    struct cdr_index *idx;
+    struct cdr_range *range;
+    size_t size, isize;
+    uint32_t i;
+    FILE *fp;
+
+    seg_path(st, s->seq, "cdr", path);
+    if (!(s->rec = map_file(path, &size)))
+	return -1;
+    s->count = size / sizeof(struct cdr_record);
+    isize = s->count * sizeof(struct cdr_index) + sizeof(struct cdr_range);
+
+    seg_path(st, s->seq, "idx", path);
+    if (!(s->idx = map_file(path, &size)) || size != isize) {
+	if (s->idx)
+	    munmap((void *) s->idx, size);
+	s->idx = NULL;
+	if (!(idx = malloc(isize)))
+	    return -1;
+	range = (struct cdr_range *) (idx + s->count);
+	range->min_us = range->max_us = s->rec[0].time_us;
+	for (i = 0; i < s->count; i++) {
+	    idx[i].key = cdr_key(s->rec[i].number);
+	    idx[i].rec = i;
+	    idx[i].reserved = 0;
+	    if (s->rec[i].time_us < range->min_us)      // Not in order if the clock was set back
+		range->min_us = s->rec[i].time_us;
+	    if (s->rec[i].time_us > range->max_us)
+		range->max_us = s->rec[i].time_us;
+	}
+	qsort(idx, s->count, sizeof(*idx), index_cmp);
+
+	if (st->rdonly) {                       // Kept in memory
+	    s->idx = idx;
+	    s->idx_heap = 1;
+	} else {
+	    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	    if (!(fp = fopen(tmp, "wb"))) {
+		free(idx);
+		return -1;
+	    }
+	    size = fwrite(idx, 1, isize, fp);
+	    free(idx);
+	    if (fclose(fp) || size != isize || rename(tmp, path))
+		return -1;
+	    if (!(s->idx = map_file(path, &size)))
+		return -1;
+	}
+    }
+    range = (struct cdr_range *) (s->idx + s->count);
+    s->min_us = range->min_us;
+    s->max_us = range->max_us;
+    s->sealed = 1;
+    return 0;
+}
+
+/**@brief Open the next segment for append */
+static int cdr_next_segment(cdr_store * st)
+{
+    char path[CDR_PATH_LEN];
+    struct cdr_seg *s;
+
+    if (st->nseg == CDR_MAX_SEGS)
+	return -1;
+    s = &st->seg[st->nseg];
+    memset(s, 0, sizeof(*s));
+    s->seq = st->nseg ? st->seg[st->nseg - 1].seq + 1 : 0;
+
+    seg_path(st, s->seq, "cdr", path);
+    if ((st->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1)
+	return -1;
+    st->active_count = 0;
+    st->nseg++;
+    return 0;
+}
+
+static int seq_cmp(const void *a, const void *b)
+{
+    const struct cdr_seg *x = a, *y = b;
+
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/**@brief Open the store, for append or for queries only */
+static cdr_store *cdr_load(const char *dir, int rdonly)
+{
+    cdr_store *st;
+    DIR *d;
+    struct dirent *de;
+    struct stat sb;
+    char path[CDR_PATH_LEN];
+    unsigned int seq;
+    int i;
+
+    if (!rdonly)
+	mkdir(dir, 0755);
+    if (!(d = opendir(dir)) || !(st = calloc(1, sizeof(*st)))) {
+	if (d)
+	    closedir(d);
+	return NULL;
+    }
+    st->fd = -1;
+    st->rdonly = rdonly;
+    if (snprintf(st->dir, sizeof(st->dir), "%s", dir) >= (int) sizeof(st->dir)) {
+	closedir(d);
+	free(st);
+	return NULL;
+    }
+
+    while ((de = readdir(d)) && st->nseg < CDR_MAX_SEGS) {
+	if (strlen(de->d_name) == 12 && !strcmp(de->d_name + 8, ".cdr") &&
+	    sscanf(de->d_name, "%8u", &seq) == 1)
+	    st->seg[st->nseg++].seq = seq;
+    }
+    closedir(d);
+    qsort(st->seg, st->nseg, sizeof(st->seg[0]), seq_cmp);
+
+    for (i = 0; i < st->nseg; i++) {
+	seg_path(st, st->seg[i].seq, "cdr", path);
+	if (stat(path, &sb) == -1)
+	    goto fail;
+	if (i == st->nseg - 1 && sb.st_size / sizeof(struct cdr_record) < CDR_SEG_RECORDS)
+	    break;                                      // Active segment
+	if (sb.st_size < (off_t) sizeof(struct cdr_record)) {  // Nothing to seal
+	    memmove(&st->seg[i], &st->seg[i + 1], (st->nseg - i - 1) * sizeof(st->seg[0]));
+	    st->nseg--;
+	    i--;
+	    continue;
+	}
+	if (!rdonly && sb.st_size % sizeof(struct cdr_record) &&        // Torn write of a crash
+	    truncate(path, sb.st_size - sb.st_size % sizeof(struct cdr_record)))
+	    goto fail;
+	if (cdr_seal(st, &st->seg[i]))
+	    goto fail;
+    }
+
+    if (rdonly) {                                       // Records written so far are queried,
+	if (st->nseg && !st->seg[st->nseg - 1].sealed)  // a torn tail is left to the writer
+	    st->active_count = sb.st_size / sizeof(struct cdr_record);
+    } else if (st->nseg && !st->seg[st->nseg - 1].sealed) {    // Append to the last segment
+	seg_path(st, st->seg[st->nseg - 1].seq, "cdr", path);
+	if ((st->fd = open(path, O_WRONLY | O_APPEND)) == -1 || fstat(st->fd, &sb) == -1)
+	    goto fail;
+	st->active_count = sb.st_size / sizeof(struct cdr_record);
+	if (sb.st_size % sizeof(struct cdr_record) &&  // Torn write of a crash
+	    ftruncate(st->fd, (off_t) st->active_count * sizeof(struct cdr_record)))
+	    goto fail;
+    } else if (cdr_next_segment(st))
+	goto fail;
+
+    return st;
+
+  fail:
+    cdr_close(st);
+    return NULL;
+}
+
+/**@brief Open (or create) the store in a directory.
+ *
+ * Full segments are sealed (their index is rebuilt if missing), the last
+ * segment is opened for append.
+ *
+ * @param dir directory of the store
+ * @return Returns a pointer to a malloc'd cdr_store, or NULL on error.
+ */
+cdr_store *cdr_open(const char *dir)
+{
+    return cdr_load(dir, 0);
+}
+
+/**@brief Open the store in a directory for queries only.
+ *
+ * Nothing is created, sealed or truncated, so the store can be queried
+ * while cid_fsk appends to it. A missing index is built in memory.
+ * cdr_append() fails on this store.
+ *
+ * @param dir directory of the store
+ * @return Returns a pointer to a malloc'd cdr_store, or NULL on error.
+ */
+cdr_store *cdr_open_rdonly(const char *dir)
+{
+    return cdr_load(dir, 1);
+}
+
+/**@brief Write the batched records.
+ *
+ * A batch crossing the end of a segment is split, the full segment is
+ * sealed and the rest goes to a new segment. On error the records not
+ * written stay in the batch.
+ *
+ * @param st pointer to the store
+ * @return 0 if successful else -1 if error
+ */
+int cdr_flush(cdr_store * st)
+{
+    int done = 0, n, res = 0;
+    size_t bytes;
+    ssize_t w;
+
+    while (done < st->nbatch) {
+	n = st->nbatch - done;
+	if (n > (int) (CDR_SEG_RECORDS - st->active_count))
+	    n = CDR_SEG_RECORDS - st->active_count;
+
+	bytes = n * sizeof(struct cdr_record);
+	if ((w = write(st->fd, st->batch + done, bytes)) > 0) {
+	    st->active_count += w / sizeof(struct cdr_record);
+	    done += w / sizeof(struct cdr_record);
+	}
+	if (w != (ssize_t) bytes) {             // The records written are kept, a torn one is cut
+	    if (w > 0 && w % sizeof(struct cdr_record) &&
+		ftruncate(st->fd, (off_t) st->active_count * sizeof(struct cdr_record))) {
+		close(st->fd);                  // Not appended to any more, cut on the next open
+		st->fd = -1;
+	    }
+	    res = -1;
+	    break;
+	}
+
+	if (st->active_count == CDR_SEG_RECORDS) {
+	    close(st->fd);
+	    st->fd = -1;
+	    if (cdr_seal(st, &st->seg[st->nseg - 1]) || cdr_next_segment(st)) {
+		res = -1;
+		break;
+	    }
+	}
+    }
+    st->nbatch -= done;                         // The rest is written by the next flush
+    memmove(st->batch, st->batch + done, st->nbatch * sizeof(st->batch[0]));
+    return res;
+}
+
+/**@brief Append a record.
+ *
+ * The record is written with the next full batch, or by cdr_flush().
+ *
+ * @param st pointer to the store
+ * @param r the record
+ * @return 0 if successful else -1 if error
+ */
+int cdr_append(cdr_store * st, const struct cdr_record *r)
+{
+    if (st->rdonly || (st->nbatch == CDR_BATCH && cdr_flush(st)))
+	return -1;                              // Batch still full after a failed flush
+    st->batch[st->nbatch++] = *r;
+    if (st->nbatch == CDR_BATCH)
+	return cdr_flush(st);
+    return 0;
+}
+
+/**@brief Check a record against the query, call the callback if it matches */
+static int cdr_match(const struct cdr_record *r, const char *number,
+		     int64_t since_us, int64_t until_us, cdr_callback cb, void *arg, int *found)
+{
+    if (r->time_us < since_us || r->time_us > until_us ||
+	strncmp(r->number, number, CDR_NUM_LEN))
+	return 0;
+    (*found)++;
+    return cb ? cb(r, arg) : 0;
+}
+
+/**@brief Find the calls from a number in a time range.
+ *
+ * The records are given to the callback from the oldest to the latest.
+ *
+ * @param st pointer to the store
+ * @param number the number
+ * @param since_us start of the range
+ * @param until_us end of the range
+ * @param cb called for every matching record, NULL to only count them
+ * @param arg passed to the callback
+ *
+ * @return no. of matching records, or -1 on error
+ */
+int cdr_query(cdr_store * st, const char *number, int64_t since_us, int64_t until_us,
+	      cdr_callback cb, void *arg)
+{
+    char path[CDR_PATH_LEN];
+    const struct cdr_record *rec;
+    struct cdr_seg *s;
+    uint64_t key = cdr_key(number);
+    uint32_t lo, hi, mid;
+    size_t size = 0;
+    int found = 0, i, stop = 0;
+
+    for (i = 0; i < st->nseg && !stop; i++) {
+	s = &st->seg[i];
+	if (!s->sealed)
+	    break;
+	if (s->max_us < since_us || s->min_us > until_us)
+	    continue;                           // Segment outside of the range
+
+	for (lo = 0, hi = s->count; lo < hi;) { // First index entry of the key
+	    mid = lo + (hi - lo) / 2;
+	    if (s->idx[mid].key < key)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	for (; lo < s->count && s->idx[lo].key == key && !stop; lo++)
+	    stop = cdr_match(&s->rec[s->idx[lo].rec], number, since_us, until_us, cb, arg, &found);
+    }
+
+    if (!stop && st->active_count) {            // Active segment is scanned
+	seg_path(st, st->seg[st->nseg - 1].seq, "cdr", path);
+	if (!(rec = map_file(path, &size)))
+	    return -1;
+	for (mid = 0; mid < st->active_count && !stop; mid++)
+	    stop = cdr_match(&rec[mid], number, since_us, until_us, cb, arg, &found);
+	munmap((void *) rec, size);
+    }
+
+    for (i = 0; i < st->nbatch && !stop; i++)   // and the records not written yet
+	stop = cdr_match(&st->batch[i], number, since_us, until_us, cb, arg, &found);
+
+    return found;
+}
+
+/**@brief Flush and close the store.
+ * @param st pointer to the store
+ */
+void cdr_close(cdr_store * st)
+{
+    int i;
+
+    if (!st)
+	return;
+    if (st->fd != -1) {
+	cdr_flush(st);
+	close(st->fd);
+    }
+    for (i = 0; i < st->nseg; i++) {
+	if (st->seg[i].rec)
+	    munmap((void *) st->seg[i].rec, st->seg[i].count * sizeof(struct cdr_record));
+	if (st->seg[i].idx_heap)
+	    free((void *) st->seg[i].idx);
+	else if (st->seg[i].idx)
+	    munmap((void *) st->seg[i].idx,
+		   st->seg[i].count * sizeof(struct cdr_index) + sizeof(struct cdr_range));
+    }
+    free(st);
+}
@@ -0,0 +1,477 @@
+/**@file cidbench.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Worst case processing time of the decoder under adversarial audio
+ *
+ * The average cost measured by cid_tune hides the stalls: noise and voice
+ * make fsk_serial() try the channel seizure again and again, and large
+ * blocks keep get_channel_seizure() looping. Every class of signal below is
+ * synthesized at the internal rate and fed block by block the way cid_fsk
+ * does, samples left over carried to the next block. The time of every
+ * block is measured and its p50, p99, p99.99 and max are printed, with the
+ * max as a percentage of the real time budget of the block. A percentile
+ * needs BENCH_TAIL blocks beyond it, else it is printed as '-' (p99.99 of
+ * 10 s of the default blocks, 107 of them, would just be the max again);
+ * -s makes the signals long enough.					<BR>
+ *      silence : all zeros						<BR>
+ *      noise   : white noise						<BR>
+ *      speech  : voiced harmonics with moving formants and syllables	<BR>
+ *      dtmf    : random DTMF digits					<BR>
+ *      fax     : CNG and CED tones, then V.21 HDLC flags		<BR>
+ *      clipped : spills clipped 12 dB above full scale		<BR>
+ *      nearmiss: spills 8% slower than the decoder			<BR>
+ *      spill   : valid spills, for reference				<BR>
+ * After a byte that cannot start a message, and after every message, the
+ * line is restarted, as the message decoder of cid_fsk does.
+ *
+ * -l runs the batch slicer (fskbatch.c) instead, on LINES interleaved
+ * lines: every third line gets a spill with its own number, the others
+ * silence or a noise under the gate. The frames are fed a chunk at a time
+ * and the bytes framed after every chunk, the bit queue of a line holds
+ * less than two bytes. Per line it prints the bits sliced, the chunks
+ * skipped as idle, the framing errors, the bits overrun, the bytes framed
+ * and how many bytes of the message they have in a row.
+ *
+ * Usage: ./cid_bench [-b 'BLOCK'] [-e 'ENGINE'] [-s 'SECS'] [-l 'LINES']	<BR>
+ * BLOCK : samples per block, PROFILE_PERIOD_SIZE * PROFILE_PERIOD_COUNT by default <BR>
+ * ENGINE : demodulation engine, iir by default				<BR>
+ * SECS : seconds of every signal, 10 by default			<BR>
+ * LINES : lines sliced by the batch slicer, up to FSK_BATCH_LANES
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fskmodem.h"
+#include "ciddeco.h"
+#include "fsktx.h"
+#include "fskbatch.h"
+#include "resample.h"
+#include "profile.h"
+
+#define BENCH_SECS              10      // Default length of every signal
+#define BENCH_LEVEL             8000    // RMS of the synthetic signals
+#define BENCH_GAP_MS            200     // Silence between two spills
+#define BENCH_BAUD_MISS         1.08    // Bit period of the near miss spills
+#define BENCH_ISPB              ((float) CID_CANONICAL_RATE / FSK_BAUD)        // Samples per bit
+#define BENCH_TAIL              10      // Blocks beyond a percentile for it to be printed
+#define BENCH_STAGGER_MS        150     // Delay between the spills of two lines
+#define BENCH_QUIET             40      // Peak of the noise under the gate of the batch slicer
+#define BENCH_BYTES             1024    // Bytes framed kept per line
+
+/// Synthesizes one class of signal
+struct bench_class {
+    const char *name;
+    void (*make)(short *s, int n);
+};
+
+static unsigned int seed = 12345;
+
+/**@brief Uniform random number in [-1, 1) (xorshift, same every run) */
+static double urand(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed / 2147483648.0 - 1;
+}
+
+/**@brief Clip a sample to 16 bits */
+static short clip(double v)
+{
+    return (v > 32767) ? 32767 : ((v < -32768) ? -32768 : (short) lrint(v));
+}
+
+static void make_silence(short *s, int n)
+{
+    memset(s, 0, n * sizeof(short));
+}
+
+static void make_noise(short *s, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)     // Sum of 4 uniforms, close to gaussian
+	s[i] = clip(BENCH_LEVEL * (urand() + urand() + urand() + urand()) * 0.866);
+}
+
+static void make_speech(short *s, int n)
+{
+    static const double formant[3] = { 700, 1200, 2500 };
+    double t, f0, ph = 0, v, w, env, f;
+    int i, k, j;
+
+    for (i = 0; i < n; i++) {
+	t = (double) i / CID_CANONICAL_RATE;
+	f0 = 120 + 20 * sin(2 * M_PI * 3 * t);                  // Pitch glide
+	ph += 2 * M_PI * f0 / CID_CANONICAL_RATE;
+	env = 0.5 - 0.5 * cos(2 * M_PI * 4 * t);                // Syllables
+	if (fmod(t, 2.5) > 2)                                   // Pauses
+	    env = 0;
+	for (k = 1, v = 0; k * f0 < 4000; k++) {
+	    for (j = 0, w = 0; j < 3; j++) {
+		f = formant[j] * (1 + 0.2 * sin(2 * M_PI * (0.7 + j * 0.3) * t));
+		w += exp(-(k * f0 - f) * (k * f0 - f) / (2 * 150.0 * 150.0));
+	    }
+	    v += w * sin(k * ph);
+	}
+	s[i] = clip(BENCH_LEVEL * 1.5 * env * v + 200 * urand());
+    }
+}
+
+static void make_dtmf(short *s, int n)
+{
+    static const int low[4] = { 697, 770, 852, 941 };
+    static const int high[4] = { 1209, 1336, 1477, 1633 };
+    int tone = 60 * CID_CANONICAL_RATE / 1000;  // 60 ms on, 60 ms off
+    int i, fl = 0, fh = 0;
+
+    for (i = 0; i < n; i++) {
+	if (i % (2 * tone) == 0) {
+	    fl = low[(int) ((urand() + 1) * 2) & 3];
+	    fh = high[(int) ((urand() + 1) * 2) & 3];
+	}
+	s[i] = ((i % (2 * tone)) < tone) ?
+	    clip(BENCH_LEVEL * (sin(2 * M_PI * fl * i / CID_CANONICAL_RATE) +
+				sin(2 * M_PI * fh * i / CID_CANONICAL_RATE))) : 0;
+    }
+}
+
+static void make_fax(short *s, int n)
+{
+    int rate = CID_CANONICAL_RATE;
+    double ph = 0;
+    int i, bit, f;
+
+    for (i = 0; i < n; i++) {
+	int ms = (int) ((long long) i * 1000 / rate) % 8000;
+
+	if (ms < 500)                                   // CNG, 1100 Hz
+	    f = 1100;
+	else if (ms < 3000)
+	    f = 0;
+	else if (ms < 6000)                             // CED, 2100 Hz
+	    f = 2100;
+	else {                                          // V.21 flags 0x7E at 300 baud
+	    bit = (0x7e >> ((int) ((long long) i * 300 / rate) % 8)) & 1;
+	    f = bit ? 1650 : 1850;
+	}
+	ph += 2 * M_PI * f / rate;
+	s[i] = f ? clip(BENCH_LEVEL * 1.4 * sin(ph)) : 0;
+    }
+}
+
+/**@brief Back to back spills at a bit rate, scaled
+ * @param s samples to fill
+ * @param n no. of samples
+ * @param baud bit rate
+ * @param gain scale of the samples, clipped to 16 bits
+ */
+static void make_spills(short *s, int n, int baud, double gain)
+{
+    cid_tx *tx;
+    unsigned char msg[TX_MAX_MSG];
+    int i, off, len, busy;
+
+    if (!(tx = malloc(sizeof(*tx))) ||
+	cid_tx_init(tx, 1, CID_CANONICAL_RATE, baud, CID_SIG_V23, BENCH_LEVEL * 1.4)) {
+	free(tx);
+	make_silence(s, n);
+	return;
+    }
+
+    len = cid_msg_build(msg, MDMF, "06070809", "9987654321", "John Smith");
+    for (off = 0; off < n;) {
+	cid_tx_ring(tx, 0, tx->now, BENCH_GAP_MS, msg, len);
+	for (busy = 1; busy && off < n; off += i) {
+	    i = (n - off < 256) ? n - off : 256;
+	    busy = cid_tx_render(tx, s + off, i);
+	}
+    }
+    for (i = 0; i < n; i++)
+	s[i] = clip(s[i] * gain);
+    free(tx);
+}
+
+static void make_clipped(short *s, int n)
+{
+    make_spills(s, n, FSK_BAUD, 4);
+}
+
+static void make_nearmiss(short *s, int n)
+{
+    make_spills(s, n, FSK_BAUD / BENCH_BAUD_MISS, 1);
+}
+
+static void make_valid(short *s, int n)
+{
+    make_spills(s, n, FSK_BAUD, 1);
+}
+
+static const struct bench_class classes[] = {
+    { "silence", make_silence },
+    { "noise", make_noise },
+    { "speech", make_speech },
+    { "dtmf", make_dtmf },
+    { "fax", make_fax },
+    { "clipped", make_clipped },
+    { "nearmiss", make_nearmiss },
+    { "spill", make_valid },
+};
+
+/**@brief Print a percentile of the sorted block times, '-' if too few blocks
+ * @param ns sorted times
+ * @param nblk no. of blocks
+ * @param p percentile, 0.99 for p99
+ */
+static void print_pct(const long long *ns, int nblk, double p)
+{
+    if (nblk * (1 - p) >= BENCH_TAIL)
+	printf(" %9.1f", ns[(int) (nblk * p)] / 1e3);
+    else
+	printf(" %9s", "-");
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *) a, y = *(const long long *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**@brief Decode a signal block by block and time every block
+ * @param s samples
+ * @param n no. of samples
+ * @param engine demodulation engine
+ * @param block samples per block
+ * @param ns time of every block, in nano seconds
+ * @param msgs no. of messages framed
+ * @return no. of blocks, -1 if out of memory
+ */
+static int bench_run(const short *s, int n, int engine, int block, long long *ns, int *msgs)
+{
+    fsk_data fskd;
+    struct timespec t0, t1;
+    short *work, *buf;
+    int off, nin, nblk = 0, mylen, olen, b, nbytes = 0, msg_len = 0;
+
+    if (!(work = malloc((n + block) * sizeof(short))))
+	return -1;
+
+    fsk_line_init(&fskd, BENCH_ISPB, CID_SIG_V23, engine);
+    *msgs = 0;
+    buf = work;
+    for (off = 0; off < n; off += nin) {
+	nin = (n - off < block) ? n - off : block;
+	memcpy(work + off, s + off, nin * sizeof(short));
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	mylen = work + off + nin - buf;
+	while (mylen >= fskd.ispb * FSK_FRAME_BITS) {
+	    olen = mylen;
+	    if (fsk_serial(&fskd, buf, &mylen, &b)) {
+		/* Restart the line as decode_CID_msg() would: on a byte which
+		   is not a message type, and at the end of the message */
+		if (nbytes == 0 && b != MDMF && b != SDMF)
+		    fsk_line_init(&fskd, BENCH_ISPB, CID_SIG_V23, engine);
+		else if (++nbytes == 2)
+		    msg_len = b + 3;
+		else if (nbytes > 2 && nbytes == msg_len) {
+		    (*msgs)++;
+		    nbytes = 0;
+		    fsk_line_init(&fskd, BENCH_ISPB, CID_SIG_V23, engine);
+		}
+		if (nbytes == 0)
+		    msg_len = 0;
+	    }
+	    buf += (olen - mylen);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns[nblk++] = (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+    }
+
+    free(work);
+    return nblk;
+}
+
+/**@brief Bytes of a message framed in a row
+ * @return the most bytes of msg, from its first one, found in a row
+ */
+static int bench_found(const unsigned char *bytes, int n, const unsigned char *msg, int len)
+{
+    int i, k, best = 0;
+
+    for (i = 0; i < n; i++) {
+	for (k = 0; k < len && i + k < n && bytes[i + k] == msg[k]; k++);
+	if (k > best)
+	    best = k;
+    }
+    return best;
+}
+
+/**@brief Slice interleaved lines with the batch slicer and frame their bytes
+ * @param nlines no. of lines
+ * @param n no. of frames
+ * @param engine demodulation engine
+ * @return 0 if successful, -1 if out of memory
+ */
+static int bench_batch(int nlines, int n, int engine)
+{
+    static fsk_data fskd[FSK_BATCH_LANES];
+    static fsk_batch b;
+    static unsigned char bytes[FSK_BATCH_LANES][BENCH_BYTES];
+    static const char *kind[3] = { "spill", "silence", "quiet" };
+    unsigned char msg[FSK_BATCH_LANES][TX_MAX_MSG];
+    int len[FSK_BATCH_LANES], nbytes[FSK_BATCH_LANES] = { 0 };
+    fsk_data *lines[FSK_BATCH_LANES];
+    char number[16];
+    struct timespec t0, t1;
+    long long ns;
+    cid_tx *tx;
+    short *s;
+    int i, l, off, c;
+
+    if (!(s = malloc((long) n * nlines * sizeof(short))) || !(tx = malloc(sizeof(*tx)))) {
+	free(s);
+	return -1;
+    }
+
+    cid_tx_init(tx, nlines, CID_CANONICAL_RATE, FSK_BAUD, CID_SIG_V23, BENCH_LEVEL * 1.4);
+    for (l = 0; l < nlines; l++) {
+	snprintf(number, sizeof(number), "99876543%02d", l);
+	len[l] = cid_msg_build(msg[l], MDMF, "06070809", number, "John Smith");
+	if (l % 3 == 0)
+	    cid_tx_ring(tx, l, 0, BENCH_GAP_MS + l * BENCH_STAGGER_MS, msg[l], len[l]);
+    }
+    for (off = 0; off < n; off += i) {
+	i = (n - off < 256) ? n - off : 256;
+	cid_tx_render(tx, s + (long) off * nlines, i);
+    }
+    for (i = 0; i < n; i++)
+	for (l = 2; l < nlines; l += 3)
+	    s[(long) i * nlines + l] = BENCH_QUIET * urand();
+    free(tx);
+
+    for (l = 0; l < nlines; l++) {
+	fsk_line_init(&fskd[l], BENCH_ISPB, CID_SIG_V23, engine);
+	lines[l] = &fskd[l];
+    }
+    fsk_batch_init(&b, lines, nlines);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (off = 0; off < n; off += i) {
+	i = (n - off < FSK_BATCH_CHUNK) ? n - off : FSK_BATCH_CHUNK;
+	fsk_batch_feed(&b, s + (long) off * nlines, i);
+	for (l = 0; l < nlines; l++)
+	    while ((c = fsk_batch_get_byte(&b, l)) != -1)
+		if (c >= 0 && nbytes[l] < BENCH_BYTES)
+		    bytes[l][nbytes[l]++] = c;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+
+    printf("engine %s, %d lines, %d s, %.1f ns per frame (%.2f%% of real time)\n",
+	   fsk_engine_name(engine), nlines, n / CID_CANONICAL_RATE, (double) ns / n,
+	   100.0 * ns / 1e9 / ((double) n / CID_CANONICAL_RATE));
+    printf("%-5s %-8s %7s %7s %7s %7s %6s %7s\n", "line", "signal", "bits", "idle",
+	   "framing", "overrun", "bytes", "msg");
+    for (l = 0; l < nlines; l++) {
+	printf("%-5d %-8s %7u %7llu %7u %7u %6d", l, kind[l % 3], b.q[l].head, b.idle[l],
+	       b.q[l].framing, b.q[l].overrun, nbytes[l]);
+	if (l % 3 == 0)
+	    printf(" %4d/%d\n", bench_found(bytes[l], nbytes[l], msg[l], len[l]), len[l]);
+	else
+	    printf(" %7s\n", "-");
+    }
+
+    free(s);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int block = PROFILE_PERIOD_SIZE * PROFILE_PERIOD_COUNT;
+    int engine = FSK_ENGINE_IIR;
+    int secs = BENCH_SECS;
+    int nlines = 0;
+    int n, nblk, msgs, i, err, null;
+    double budget_us;
+    long long *ns;
+    short *s;
+
+    for (argv++; *argv; argv++) {
+	if (strcmp(*argv, "-b") == 0 && argv[1])
+	    block = atoi(*++argv);
+	else if (strcmp(*argv, "-e") == 0 && argv[1]) {
+	    if ((engine = fsk_engine_lookup(*++argv)) < 0) {
+		fprintf(stderr, "Unknown engine %s\n", *argv);
+		return EXIT_FAILURE;
+	    }
+	} else if (strcmp(*argv, "-s") == 0 && argv[1])
+	    secs = atoi(*++argv);
+	else if (strcmp(*argv, "-l") == 0 && argv[1])
+	    nlines = atoi(*++argv);
+	else {
+	    printf("Usage: ./cid_bench [-b 'BLOCK'] [-e 'ENGINE'] [-s 'SECS'] [-l 'LINES']\n");
+	    return 0;
+	}
+    }
+    if (block <= 0 || secs <= 0 || nlines < 0 || nlines > FSK_BATCH_LANES)
+	return EXIT_FAILURE;
+
+    n = secs * CID_CANONICAL_RATE;
+    if (nlines) {
+	if (bench_batch(nlines, n, engine)) {
+	    fprintf(stderr, "Unable to allocate %d frames of %d lines\n", n, nlines);
+	    return EXIT_FAILURE;
+	}
+	return 0;
+    }
+    if (!(s = malloc(n * sizeof(short))) || !(ns = malloc((n / block + 1) * sizeof(*ns)))) {
+	fprintf(stderr, "Unable to allocate %d samples\n", n);
+	return EXIT_FAILURE;
+    }
+
+    budget_us = 1e6 * block / CID_CANONICAL_RATE;
+    printf("engine %s, block %d (%.0f us of audio), %d s per signal\n",
+	   fsk_engine_name(engine), block, budget_us, secs);
+    printf("%-9s %7s %5s %9s %9s %9s %9s %7s\n", "signal", "blocks", "msgs",
+	   "p50 us", "p99 us", "p99.99 us", "max us", "max %");
+
+    err = dup(2);
+    null = open("/dev/null", O_WRONLY);
+
+    for (i = 0; i < (int) (sizeof(classes) / sizeof(classes[0])); i++) {
+	classes[i].make(s, n);
+
+	if (null >= 0)                  // The bit trace of fsk_serial() is not wanted here
+	    dup2(null, 2);
+	nblk = bench_run(s, n, engine, block, ns, &msgs);
+	fflush(stderr);
+	dup2(err, 2);
+	if (nblk <= 0) {
+	    fprintf(stderr, "%s: out of memory\n", classes[i].name);
+	    continue;
+	}
+
+	qsort(ns, nblk, sizeof(*ns), cmp_ll);
+	printf("%-9s %7d %5d", classes[i].name, nblk, msgs);
+	print_pct(ns, nblk, 0.5);
+	print_pct(ns, nblk, 0.99);
+	print_pct(ns, nblk, 0.9999);
+	printf(" %9.1f %6.1f%%\n", ns[nblk - 1] / 1e3, 100 * ns[nblk - 1] / 1e3 / budget_us);
+    }
+
+    close(err);
+    if (null >= 0)
+	close(null);
+    free(ns);
+    free(s);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/**@file cidcdr.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Queries the store of the decoded calls
+ *
+ * Usage: ./cid_cdr 'DIR' query 'NUMBER' ['DAYS']				<BR>
+ *        ./cid_cdr 'DIR' insert 'COUNT'
+ *
+ * insert appends COUNT synthetic calls spread over the last 60 days, to
+ * measure the insert rate and to have data to query.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cdrstore.h"
+
+#define DAY_US                  (86400LL * 1000000)
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static double elapsed(struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static int print_record(const struct cdr_record *r, void *arg)
+{
+    time_t t = r->time_us / 1000000;
+    char when[32];
+
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    printf("%s line %u %.20s %.20s%s\n", when, r->line, r->number, r->name,
+	   r->cksum_ok ? "" : " (checksum failed)");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    cdr_store *st;
+    struct cdr_record r;
+    struct timespec t0;
+    int64_t start;
+    int i, n;
+    double s;
+
+    if (argc < 4 || (strcmp(argv[2], "query") && strcmp(argv[2], "insert"))) {
+	printf("Usage: ./cid_cdr 'DIR' query 'NUMBER' ['DAYS']\n");
+	printf("       ./cid_cdr 'DIR' insert 'COUNT'\n");
+	return 0;
+    }
+
+    st = strcmp(argv[2], "query") ? cdr_open(argv[1]) : cdr_open_rdonly(argv[1]);
+    if (!st) {
+	fprintf(stderr, "Unable to open call store %s\n", argv[1]);
+	return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (!strcmp(argv[2], "insert")) {
+	n = atoi(argv[3]);
+	start = now_us() - 60 * DAY_US;
+	memset(&r, 0, sizeof(r));
+	for (i = 0; i < n; i++) {
+	    r.time_us = start + (60 * DAY_US / n) * i;
+	    snprintf(r.number, sizeof(r.number), "555%07d", rand() % 100000);
+	    r.cksum_ok = 1;
+	    r.line = i % 16;
+	    if (cdr_append(st, &r)) {
+		perror("appending call record");
+		break;
+	    }
+	}
+	cdr_flush(st);
+	s = elapsed(&t0);
+	printf("%d records in %.3f s (%.0f records/s)\n", i, s, i / s);
+    } else {
+	int days = (argc > 4) ? atoi(argv[4]) : 30;
+	n = cdr_query(st, argv[3], now_us() - days * DAY_US, now_us(), print_record, NULL);
+	printf("%d calls from %s in the last %d days (%.3f ms)\n", n, argv[3], days,
+	       elapsed(&t0) * 1000);
+    }
+
+    cdr_close(st);
+    return 0;
+}
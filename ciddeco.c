@@ -14,25 +14,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
 #include "fskmodem.h"
 #include "ciddeco.h"
-
-#define MDMF                    0x80    // Multiple data message format
-#define	SDMF                    0x04    // Simple data message format
-
-#define DATE_TIME               0x01
-#define NAME                    0x07
-#define NO_NAME                 0x08
-#define NUM                     0x02
-#define NO_NUM                  0x04
+#include "resample.h"
+#include "combine.h"
+#include "numlist.h"
+#include "cnam.h"
+#include "cdrstore.h"
+#include "profile.h"
+#include "pipeline.h"
+#include "lineparm.h"
+#include "arena.h"
+#include "canary.h"
+#include "ctlsock.h"
+#include "softbit.h"
+#include "spillarc.h"
+#include "capsrc.h"
+#include "audbus.h"
 
 #define MESSAGE_TYPE            0       // Message type
 #define MESSAGE_LENGTH          1       // length of Message
@@ -45,13 +53,61 @@
 /* Global variables */
 sem_t mutex;
 int capturing = 0, buf_ready = 0;
+unsigned int buf_gap = 0;               // Frames lost by an xrun before the block in buffer
+int ring_pending = 0;                   // A RING started a capture window, not seen by main yet
 struct timeval stop, start;
 int diff;
 
 struct callerid_state *cs = NULL;       // Structure containing Caller ID parameters 
+numlist *nlist = NULL;                  // Block/allow list checked for every number
+cnam_cache *cnam = NULL;                // Caller names from the directory service
+cdr_store *cdr = NULL;                  // Store of the decoded calls
+pthread_mutex_t cdr_lock = PTHREAD_MUTEX_INITIALIZER;  // Store shared with its flusher
+int cid_line = 0;                       // Line decoded by this process
+const char *lp_path = NULL;             // File of the learned line parameters
+struct line_params lparm;               // Learned parameters of the line
+canary *can = NULL;                     // Canary spills on the virtual line
+int canary_dump = 0;                    // Print the canary histogram and its pipeline (SIGUSR1)
+int pipe_dump = 0;                      // Print the pipeline of the line (SIGUSR1)
+int quit = 0;                           // Terminate from the main loop (SIGTSTP, SIGTERM)
+pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER; // Sinks shared with the canary thread
+ctl_sock *ctl = NULL;                   // Control socket arming the line
+softbit_writer *sbw = NULL;             // Cache the spills are recorded to
+spillarc_writer *arcw = NULL;           // Audio of the spill, archived when it ends
+const char *arc_dir = NULL;             // Directory of the spill archives
+capsrc_writer *caprec = NULL;           // Recording of the capture, with the timestamps
+capsrc_reader *capplay = NULL;          // Recording replayed instead of the sound card
+audbus *bus = NULL;                     // Bus the periods are captured into, for other processes
 struct pcm *pcm;
-char *buffer;
+char *buffer;                           // Period captured, a slot of the bus with -M
 
+/// Virtual line of the canaries, run by canary_thread()
+struct canary_line {
+	const line_arena *arena;        ///< Arena the line is carved out of
+	line_slot slot;                 ///< Buffers of the virtual line
+	param demod_param;              ///< Same as the line's, never warm started
+	int cid_signalling;             ///< Type of signalling in use
+	int rate;                       ///< Sampling rate, the one of the capture
+	resampler *rs;                  ///< Resampler of the virtual line, NULL if not needed
+	pipeline pl;                    ///< Stages of the virtual line
+};
+
+
+/**@brief Initialize a zeroed callerID state machine in place
+ *
+ * Used for the state machines carved out of the line arena.
+ *
+ * @param cid callerid_state to initialize, all zeros
+ * @param cid_signalling Type of signalling in use
+ * @param demod_param	pointer to struct param containing sampling and baud rate
+ */
+void callerid_init(struct callerid_state *cid, int cid_signalling, param * demod_param)
+{
+    fsk_line_init(&cid->fskd, demod_param->ispb, cid_signalling, demod_param->engine);
+    cid->sawflag = 0;
+    if (demod_param->seed)                          // Warm start with what the line learned
+	lineparm_seed(&cid->fskd, demod_param->seed);
+}
 
 /**@brief Create a callerID state machine
  * 	
@@ -66,21 +122,7 @@ struct callerid_state *callerid_new(int cid_signalling, param * demod_param)
     struct callerid_state *cid;
 
     if ((cid = calloc(1, sizeof(*cid)))) {
-
-	cid->fskd.ispb = demod_param->ispb;             // Samples per bit data
-	cid->fskd.pllispb = cid->fskd.ispb * 32;        // Total count for PLL
-	cid->fskd.pllids = cid->fskd.pllispb / 32;      // PLL adustment
-        cid->fskd.pllispb2 = cid->fskd.pllispb / 2;     // PLL center point                    
-	cid->fskd.pll_round_off = 1 / (demod_param->ispb - cid->fskd.ispb);	
-	                                                // PLL roundoff
-	cid->fskd.icont = 0;                            // PLL counter Reset 
-	cid->fskd.nbit = 8;                             // no. of bits in a FSK frame
-	cid->fskd.instop = 2;                           // no. of stop bit after every byte in the data frame
-	cid->fskd.fsk_std = cid_signalling;             // FSK standard
-	cid->fskd.state = 0;
-	cid->sawflag = 0;
-
-	fskmodem_init(&cid->fskd);                      // Initializinf FSK demodulation parameters
+	callerid_init(cid, cid_signalling, demod_param);
 	return cid;
     } else
 	return NULL;
@@ -101,6 +143,8 @@ void callerid_free(struct callerid_state *cid)
 static void get_CID_info(struct callerid_state *cid, cid_data * data)
 {
     int i, j;
+    int name_missing = 1;               // No name, or name not present in the message
+    char cnam_name[CNAM_LEN];
     const char *months[12] = {
 	"January", "February", "March", "April", "May", "June",
 	"July", "August", "September", "October", "November", "December"
@@ -119,22 +163,300 @@ static void get_CID_info(struct callerid_state *cid, cid_data * data)
 	    sprintf(data->name + i, "%c", cid->rawdata[14 + i]);
 	for (j = 0; j < cid->rawdata[15 + i]; ++j)
 	    sprintf(data->number + j, "%c", cid->rawdata[16 + i + j]);
+	name_missing = (i == 0);
     } else if (cid->rawdata[12] == NUM) {
 	for (j = 0; j < cid->rawdata[13]; ++j)
 	    sprintf(data->number + j, "%c", cid->rawdata[14 + j]);
 	for (i = 0; i < cid->rawdata[15 + j]; ++i)
 	    sprintf(data->name + i, "%c", cid->rawdata[16 + j + i]);
+	name_missing = (cid->rawdata[14 + j] != NAME || i == 0);
     }
 
     memcpy(cid->name, data->name, sizeof(data->name));
     memcpy(cid->number, data->number, sizeof(data->number));
     sprintf(cid->date_time, "%s %s", data->date, data->call_time);
 
+    if (nlist)                          // Decide before the second ring
+	cid->verdict = numlist_lookup(nlist, cid->number);
+
+    /* Name from the directory, looked up since the number was parsed */
+    if (cnam && name_missing && cnam_get(cnam, cid->number, cnam_name, 0) == 1)
+	snprintf(cid->name, sizeof(cid->name), "%s", cnam_name);
+
     printf("*****************************************************\n");
     printf("%s %s %s\n", cid->date_time, cid->number, cid->name);
+    if (nlist)
+	printf("Verdict: %s\n", numlist_verdict_name(cid->verdict));
     printf("*****************************************************\n\n");
 }
 
+/**@brief Fill the call record of the decoded call
+ * @param cid callerid_state with the decoded message
+ * @param line line the call came in on
+ * @param r call record to fill
+ */
+static void call_record(struct callerid_state *cid, int line, struct cdr_record *r)
+{
+    struct timeval now;
+    int i;
+
+    memset(r, 0, sizeof(*r));
+    gettimeofday(&now, NULL);
+    r->time_us = now.tv_sec * 1000000LL + now.tv_usec;
+    strncpy(r->number, cid->number, sizeof(r->number));
+    strncpy(r->name, cid->name, sizeof(r->name));
+    for (i = 0; i < 8; i++)
+	r->date_time[i] = cid->rawdata[4 + i];
+    r->verdict = cid->verdict;
+    r->cksum_ok = cid->cksum_ok;
+    r->line = line;
+}
+
+/**@brief Append the decoded call to the call store
+ *
+ * The record waits in the batch of the store, cdr_flusher() writes it
+ * within CDR_FLUSH_MS.
+ *
+ * @param cid callerid_state with the decoded message
+ * @param line line the call came in on
+ */
+static void save_CID_info(struct callerid_state *cid, int line)
+{
+    struct cdr_record r;
+
+    call_record(cid, line, &r);
+    pthread_mutex_lock(&cdr_lock);
+    if (cdr_append(cdr, &r))
+	perror("Saving call record");
+    pthread_mutex_unlock(&cdr_lock);
+}
+
+/**@brief Thread writing the batch of the call store every CDR_FLUSH_MS
+ * @param ptr unused
+ */
+static void *cdr_flusher(void *ptr)
+{
+    while (1) {
+	usleep(CDR_FLUSH_MS * 1000);
+	pthread_mutex_lock(&cdr_lock);
+	if (cdr && cdr->nbatch && cdr_flush(cdr))
+	    perror("Saving call record");
+	pthread_mutex_unlock(&cdr_lock);
+    }
+    return NULL;
+}
+
+/**@brief Write the batch of the call store when the program exits
+ */
+static void cdr_exit(void)
+{
+    pthread_mutex_lock(&cdr_lock);
+    cdr_close(cdr);
+    cdr = NULL;
+    pthread_mutex_unlock(&cdr_lock);
+}
+
+/**@brief Start recording the soft bits and the audio of a new spill of the line
+ */
+static void spill_begin(void)
+{
+    if (sbw)
+	cs->fskd.runs = softbit_start(sbw);
+    if (arcw)
+	spillarc_reset(arcw);
+}
+
+/**@brief Keep the soft bits and the audio of the spill of the line that ended
+ * @param res result of the decoder, 0 if the spill was cut short
+ */
+static void spill_end(int res)
+{
+    struct cdr_record r;
+    struct timeval now;
+    char path[SPILLARC_PATH_LEN];
+
+    if (sbw && softbit_end(sbw, &cs->fskd, cid_line, res))
+	perror("Saving soft bits");
+
+    if (arcw && arcw->len) {
+	if (res > 0)
+	    call_record(cs, cid_line, &r);
+	gettimeofday(&now, NULL);
+	snprintf(path, sizeof(path), "%s/%d-%lld.cida", arc_dir, cid_line,
+		 now.tv_sec * 1000000LL + now.tv_usec);
+	if (spillarc_save(arcw, path, SPILLARC_SQUELCH, res, cs->fskd.engine, (res > 0) ? &r : NULL))
+	    perror("Archiving the spill");
+    }
+}
+
+/**@brief Start a new spill on a line of the arena
+ *
+ * The state machine and the message are reset in place, nothing is freed
+ * or allocated between the spills.
+ *
+ * @param a line arena
+ * @param slot buffers of the line
+ * @param cid_signalling Type of signalling in use
+ * @param demod_param pointer to struct param containing sampling and baud rate
+ */
+static void line_start(const line_arena * a, line_slot * slot, int cid_signalling,
+		       param * demod_param)
+{
+    memset(slot->cs, 0, sizeof(*slot->cs));
+    memset(slot->data, 0, sizeof(*slot->data));
+    callerid_init(slot->cs, cid_signalling, demod_param);
+    slot->cs->work = slot->work;
+    slot->cs->worklen = a->work_len;
+}
+
+/**@brief Replay the spills of a soft bit cache
+ *
+ * Only the framing and the parser run, see softbit.c. The messages go to
+ * the same sinks as the decoded ones.
+ *
+ * @param a arena of the lines
+ * @param slot buffers of the line replayed on
+ * @param cid_signalling Type of signalling in use
+ * @param demod_param parameters of the line
+ * @param path soft bit cache
+ *
+ * @return 0 if successful else -1 if the cache can't be read
+ */
+static int replay_spills(const line_arena * a, line_slot * slot, int cid_signalling,
+			 const param * demod_param, const char *path)
+{
+    softbit_reader *r;
+    param p = *demod_param;
+    struct timeval t0, t1;
+    long long fed;
+    int res, spills = 0, decoded = 0, failed = 0;
+
+    if (!(r = softbit_open(path))) {
+	perror(path);
+	return -1;
+    }
+    p.seed = NULL;                              // The recorded DPLL parameters are used
+    memset(slot->ring, 0, a->ring_len * sizeof(short));
+    gettimeofday(&t0, NULL);
+
+    while ((res = softbit_next(r)) > 0) {
+	line_start(a, slot, cid_signalling, &p);
+	softbit_seed(r, &slot->cs->fskd);
+	spills++;
+
+	/* The samples fed are not looked at, enough of them to replay every sign
+	   and complete the last bit */
+	for (fed = 0, res = 0; !res && fed < r->values + a->ring_len; fed += a->ring_len)
+	    res = callerid_feed(slot->cs, (unsigned char *) slot->ring, a->ring_len * 2);
+
+	if (res > 0) {
+	    get_CID_info(slot->cs, slot->data);
+	    if (cdr)
+		save_CID_info(slot->cs, r->spill.line);
+	    decoded++;
+	} else {
+	    fprintf(stdout, "Spill of line %d: %s\n", r->spill.line,
+		    res ? "Failed to Decode Caller ID" : "no message");
+	    failed++;
+	}
+	res = 0;
+    }
+    gettimeofday(&t1, NULL);
+
+    fprintf(stdout, "Replayed %d spills in %.3f s: %d decoded, %d not\n", spills,
+	    (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6, decoded, failed);
+    if (res < 0)
+	fprintf(stderr, "Soft bit cache %s is corrupt\n", path);
+    softbit_free(r);
+    return (res < 0) ? -1 : 0;
+}
+
+/**@brief Conceal the frames of the line lost by an xrun
+ * @param cid callerid_state of the line
+ * @param rs resampler, NULL if the samples are at CID_CANONICAL_RATE
+ * @param frames no. of frames lost, at the capture rate
+ * @return same as callerid_gap()
+ */
+static int feed_gap(struct callerid_state *cid, resampler * rs, unsigned int frames)
+{
+    long long n = frames;
+
+    if (rs)
+	n = n * rs->up / rs->down;
+    return callerid_gap(cid, n);
+}
+
+/**@brief Monotonic time in nano seconds */
+static long long mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**@brief Thread running the canaries on the virtual line
+ *
+ * A block of the virtual line is due every ring_len samples of the clock,
+ * whether the real line captures or not. The blocks the thread wakes up too
+ * late for are rendered but not decoded, and concealed like the frames lost
+ * by an xrun of the capture.
+ *
+ * @param ptr struct canary_line
+ */
+static void *canary_thread(void *ptr)
+{
+    struct canary_line *cl = ptr;
+    line_slot *sl = &cl->slot;
+    int len = cl->arena->ring_len;
+    long long period = 1000000000LL * len / cl->rate;
+    long long next = mono_ns() + period;
+    long long lat;
+    struct timespec ts;
+    unsigned int lost;
+    int n, res;
+
+    while (1) {
+	ts.tv_sec = next / 1000000000LL;
+	ts.tv_nsec = next % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+
+	res = 0;
+	for (lost = 0; mono_ns() - next >= period; next += period)
+	    if ((n = canary_render(can, sl->ring, len)) > 0)
+		lost += n;                      // Too late for the block
+	    else if (n < 0)
+		res = -1;
+	if (!res && lost)
+	    res = feed_gap(sl->cs, cl->rs, lost);
+	if (!res && (n = canary_render(can, sl->ring, len)))
+	    res = (n > 0) ? pipeline_run(&cl->pl, sl->ring, n) : -1;
+	next += period;
+
+	if (res > 0) {
+	    pthread_mutex_lock(&sink_lock);
+	    get_CID_info(sl->cs, sl->data);
+	    if (cdr)
+		save_CID_info(sl->cs, CANARY_LINE);
+	    if ((lat = canary_delivered(can, sl->cs->number)) >= 0)
+		fprintf(stdout, "Canary %u delivered in %.1f ms (p50 < %d ms, p99 < %d ms)\n",
+			can->seq, lat / 1000.0, canary_percentile(can, 0.5),
+			canary_percentile(can, 0.99));
+	    pthread_mutex_unlock(&sink_lock);
+	} else if (res < 0)
+	    canary_lost(can);
+	if (res)
+	    line_start(cl->arena, sl, cl->cid_signalling, &cl->demod_param);
+
+	if (canary_dump) {
+	    canary_report(can, stdout);
+	    pipeline_report(&cl->pl, stdout);
+	    canary_dump = 0;
+	}
+    }
+    return NULL;
+}
+
 /**@brief Decoding the CID message.
  *
  * The data block message bytes are organized as follows:                       <BR>
@@ -160,14 +482,12 @@ static void get_CID_info(struct callerid_state *cid, cid_data * data)
 static int decode_CID_msg(struct callerid_state *cid, int data_byte)
 {
     int a = data_byte;
+    int i;
 
-    static int name_field = 0;
-    static int number_field = 0;
-    static int msg_type = 0;
-    static int msg_off = 0, data_field;
+    char number[CNAM_LEN];
 
     fprintf(stderr, "\t\t%d\n\n", a);
-    cid->rawdata[msg_off++] = a;
+    cid->rawdata[cid->msg_off++] = a;
 
     switch (cid->sawflag) {
 
@@ -176,11 +496,11 @@ static int decode_CID_msg(struct callerid_state *cid, int data_byte)
 	switch (a) {
 	case MDMF:
 	    fprintf(stderr, "\t\tMessage is MDMF\n\n");
-	    msg_type = MDMF;
+	    cid->msg_type = MDMF;
 	    break;
 	case SDMF:
 	    fprintf(stderr, "\t\tMessage is SDMF\n\n");
-	    msg_type = SDMF;
+	    cid->msg_type = SDMF;
 	    break;
 	default:
 	    fprintf(stderr, "\t\tUnknown Message format\n\n");
@@ -194,6 +514,7 @@ static int decode_CID_msg(struct callerid_state *cid, int data_byte)
 	break;
     case DATA_TYPE:
 	cid->sawflag = DATA_LENGTH;
+	cid->data_type = a;
 
 	switch (a) {
 	case DATE_TIME:
@@ -201,19 +522,19 @@ static int decode_CID_msg(struct callerid_state *cid, int data_byte)
 	    break;
 	case NUM:
 	    fprintf(stderr, "\t\tData type is \"Phone Number\"\n\n");
-	    number_field = 1;
+	    cid->number_field = 1;
 	    break;
 	case NO_NUM:
 	    fprintf(stderr, "\t\tData type is \"No Number\"\n\n");
-	    number_field = 1;
+	    cid->number_field = 1;
 	    break;
 	case NAME:
 	    fprintf(stderr, "\t\tData type is \"Name\" \n\n");
-	    name_field = 1;
+	    cid->name_field = 1;
 	    break;
 	case NO_NAME:
 	    fprintf(stderr, "\t\tData type is \"No Name\" \n\n");
-	    name_field = 1;
+	    cid->name_field = 1;
 	    break;
 	default:
 	    cid->sawflag = UNKNOWN;
@@ -222,25 +543,33 @@ static int decode_CID_msg(struct callerid_state *cid, int data_byte)
 	break;
     case DATA_LENGTH:
 	fprintf(stderr, "\t\tLength of Data is %d\n\n", a);
-	data_field = a;
+	cid->data_field = a;
+	cid->data_len = a;
 	cid->sawflag = DATA;
 	break;
     case DATA:
-	if (--data_field == 0) {        // loop till we get all data bytes
-	    if ((msg_type == MDMF) && name_field && number_field) {
-		name_field = 0;
-		number_field = 0;       // Exit when last field is complete
+	if (--cid->data_field == 0) {   // loop till we get all data bytes
+	    if (cnam && cid->data_type == NUM && cid->data_len < CNAM_LEN) {
+		for (i = 0; i < cid->data_len; i++)   // Look up the name while the rest
+		    number[i] = cid->rawdata[cid->msg_off - cid->data_len + i];   // of the message comes
+		number[i] = '\0';
+		cnam_prefetch(cnam, number);
+	    }
+	    if ((cid->msg_type == MDMF) && cid->name_field && cid->number_field) {
+		cid->name_field = 0;
+		cid->number_field = 0;  // Exit when last field is complete
 		cid->sawflag = CHECKSUM;
-	    } else if ((msg_type == SDMF) && number_field) {
-		number_field = 0;       // Exit when last field is complete
+	    } else if ((cid->msg_type == SDMF) && cid->number_field) {
+		cid->number_field = 0;  // Exit when last field is complete
 		cid->sawflag = CHECKSUM;
 	    } else
 		cid->sawflag = DATA_TYPE;
 	}
 	break;
     case CHECKSUM:
-	msg_off = 0;
-	if (data_byte == (256 - (cid->cksum & 0xff)))
+	cid->msg_off = 0;
+	cid->cksum_ok = (data_byte == (256 - (cid->cksum & 0xff)));
+	if (cid->cksum_ok)
 	    printf("Checksum Passed!!\n");
 	else
 	    printf("Checksum Failed!!\n");
@@ -275,29 +604,34 @@ int callerid_feed(struct callerid_state *cid, unsigned char *ubuf, int len)
     int b = 'X';
     int res;
     int x;
-    short *buf;
+    short *buf, *work;
     short *temp_buf = (short *) ubuf;
 
     len = len / 2;                              // Because each sample is 2 bytes
     mylen = len;
 
-    buf = malloc(2 * len + cid->oldlen);        // Allocating and copying memory of
-    memcpy(buf, cid->oldstuff, cid->oldlen);    // previous samples as well.
+    if (cid->work && len + cid->oldlen / 2 <= cid->worklen)
+	work = cid->work;                       // Scratch from the line arena
+    else if (!(work = malloc(2 * len + cid->oldlen)))
+	return -1;
+    buf = work;                                 // Copying memory of previous
+    memcpy(buf, cid->oldstuff, cid->oldlen);    // samples as well.
     mylen += cid->oldlen / 2;                   // Adjusting new length
 
     for (x = 0; x < len; x++)                   // Copying current buffer from the 
 	buf[x + cid->oldlen / 2] = temp_buf[x]; // previous position.
 
-    while (mylen >= (cid->fskd.ispb * 12)) {    // For demodulating a byte we require
-	olen = mylen;                           // 10 or 11 bits. 12 for safer side
+    while (mylen >= (cid->fskd.ispb * FSK_FRAME_BITS)) {        // For demodulating a byte we
+	olen = mylen;                                           // require 10 or 11 bits
 	res = fsk_serial(&cid->fskd, buf, &mylen, &b);
 	buf += (olen - mylen);
 	if (res) {                              // When we get a data byte, we give it 
 	    res = decode_CID_msg(cid, b);       // to decoder. When complete CID message
-	    if (res == -1)
-		return -1;                      // we exit to main. When there is error
-	    else if (res)
-		return 1;
+	    if (res) {                          // we exit to main. When there is error
+		if (work != cid->work)
+		    free(work);
+		return (res == -1) ? -1 : 1;
+	    }
 	}
     }
     if (mylen) {                                // Copying remaining samples to the
@@ -306,15 +640,39 @@ int callerid_feed(struct callerid_state *cid, unsigned char *ubuf, int len)
     } else
 	cid->oldlen = 0;
 
+    if (work != cid->work)
+	free(work);
     return 0;
 }
 
+/**@brief Tell the state machine samples were lost before the next ones.
+ *
+ * The samples carried over from the last feed are demodulated before the
+ * lost ones are concealed, see fsk_gap().
+ *
+ * @param cid pointer to callerid_state data structure
+ * @param n no. of samples lost, at CID_CANONICAL_RATE
+ *
+ * @retval -1 if the spill is lost
+ * @retval 0 if it goes on
+ */
+int callerid_gap(struct callerid_state *cid, int n)
+{
+    int len = cid->oldlen / 2;
+
+    cid->oldlen = 0;
+    return fsk_gap(&cid->fskd, cid->oldstuff, len, n);
+}
+
 /**@brief Display the Wav file header information
- * @return size of the header to remove the offset from the buffer
+ * @param wavbuf bytes of the wav file
+ * @param channels pointer to store the no. of channels of the wav file
+ * @return sampling rate of the wav file
  */
 #ifdef WAVFILE
-static void getHeader(unsigned char wavbuf[])
+static int getHeader(unsigned char wavbuf[], int *channels)
 {
+    int rate;
     unsigned int i;
     wav_header *wh = malloc(sizeof(wav_header));
     unsigned char temp_buf[sizeof(wav_header)];
@@ -345,14 +703,17 @@ static void getHeader(unsigned char wavbuf[])
 	DataChunkSize   : %d\n", wh->chunk_size, wh->fmtchunk_size, wh->audio_format,
  	wh->num_channels, wh->sample_rate, wh->byte_rate, wh->bps, wh->datachunk_size);
 
+    rate = wh->sample_rate;
+    *channels = wh->num_channels;
     free(wh);
-    return;
+    return rate;
 }
 #endif
 
 void signal_handler(int sig);
 void sigkill_handler(int sig);
 void sigalrm_handler(int sig);
+void sigusr1_handler(int sig);
 
 /* Signal Handler to recieve SIGINT. It also starts an alarm to stop
 decoding after 4 seconds of the first ring. */
@@ -360,6 +721,7 @@ decoding after 4 seconds of the first ring. */
 void signal_handler(int sig)
 {
     fprintf(stdout, "\nCapturing CID message\n");
+    ring_pending = 1;                   // The spill starts afresh with this window
 
 #ifdef WAVFILE
     capturing = 0;                      // No Capturing
@@ -374,11 +736,18 @@ void signal_handler(int sig)
     signal(SIGINT, SIG_DFL);            // making SIGINT resume its default functionality 
 }
 
-/* Signal handler to terminate the process */
+/* Signal handler to terminate the process. The main loop exits, so that
+   the batch of the call store is written by cdr_exit() */
 void sigkill_handler(int sig)
 {
-    fprintf(stdout, "Program terminated\n");
-    kill(getpid(), SIGKILL);            // Terminate the process with SIGKILL
+    quit = 1;
+}
+
+/* Signal handler to print the canary histogram and the pipeline */
+void sigusr1_handler(int sig)
+{
+    canary_dump = 1;
+    pipe_dump = 1;
 }
 
 /* Signal handler to receive SIGALRM. It also stop capturing any more samples
@@ -409,6 +778,11 @@ void capture_sample(void *ptr)
 
     struct pcm_config config;
     unsigned int bytes_read = 0;
+    unsigned int frames = pcm_cap.period_size * pcm_cap.period_count;
+    unsigned int avail, lost;
+    struct timespec ts;
+    capsrc_clock clk;           // Tells the frames lost by the xruns
+    int64_t t;
 
     config.channels = pcm_cap.channels;
     config.rate = pcm_cap.rate;
@@ -422,7 +796,7 @@ void capture_sample(void *ptr)
     while (1) {
 	if (capturing) {
 	    /* Initialize the parameters of the pcm device to start capturing the samples */
-	    pcm = pcm_open(pcm_cap.card, pcm_cap.device, PCM_IN, &config);
+	    pcm = pcm_open(pcm_cap.card, pcm_cap.device, PCM_IN | PCM_MONOTONIC, &config);
 	    if (!pcm || !pcm_is_ready(pcm)) {
 		fprintf(stderr, "Unable to open PCM device (%s)\n", pcm_get_error(pcm));
 		exit(EXIT_FAILURE);
@@ -432,25 +806,114 @@ void capture_sample(void *ptr)
 		    pcm_cap.channels, pcm_cap.rate,
 		    pcm_format_to_bits(pcm_cap.format));
 
+	    capsrc_clock_init(&clk, pcm_cap.rate, pcm_cap.period_size);
+	    buf_gap = 0;
+	    if (caprec)
+		capsrc_put(caprec, CAPSRC_START, 0, capsrc_now(), 0, NULL, 0);
+
 	    /* Enter the loop once capturing starts and read the samples from the sound card.
 	       Enables buf_ready and releases the lock */
 
 	    while (capturing) {
 		if (buf_ready == 0) {
 		    sem_wait(&mutex);
+		    if (bus)                    // Captured in place on the bus
+			buffer = audbus_claim(bus);
 		    if (!pcm_read(pcm, buffer, pcm_cap.size)) {
 			bytes_read += pcm_cap.size;
+			if (pcm_get_htimestamp(pcm, &avail, &ts) == 0) {
+			    t = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+			    if ((lost = capsrc_clock_lost(&clk, t, avail, frames))) {
+				fprintf(stderr, "Xrun: %u frames lost\n", lost);
+				buf_gap += lost;        // Concealed by the decoder
+				if (caprec)
+				    capsrc_put(caprec, CAPSRC_XRUN, lost, t, avail, NULL, 0);
+			    }
+			} else {
+			    t = capsrc_now();
+			    avail = 0;
+			}
+			if (caprec)
+			    capsrc_put(caprec, CAPSRC_READ, frames, t, avail, buffer, pcm_cap.size);
+			if (bus)
+			    audbus_publish(bus, frames, t, buf_gap);
 			buf_ready = 1;
 		    } else
 			break;
 		    sem_post(&mutex);
 		}
 	    }
+	    if (caprec)
+		capsrc_put(caprec, CAPSRC_STOP, 0, capsrc_now(), 0, NULL, 0);
 	    pcm_close(pcm);
 	}
     }
 }
 
+/**@brief Thread function replaying a capture recording instead of the sound card
+ *
+ * The rings and the blocks come at the recorded times, see capsrc.c. A block
+ * due while the decoder is still busy with the previous one is delivered
+ * late, where the card would have overrun.
+ *
+ * @param ptr void pointer which will be typecasted to the struct 
+ * pcm_capture containing parameters of pcm.
+ */
+void replay_sample(void *ptr)
+{
+    pcm_capture pcm_cap = *((pcm_capture *) ptr);
+    unsigned int blocks = 0, xruns = 0, lost = 0;
+    char *block;
+    int res;
+
+    if (!(block = malloc(pcm_cap.size))) {
+	fprintf(stderr, "Unable to allocate %d bytes\n", pcm_cap.size);
+	exit(EXIT_FAILURE);
+    }
+
+    while ((res = capsrc_next(capplay, block, pcm_cap.size)) > 0) {
+	capsrc_wait(capplay);
+	switch (capplay->ev.type) {
+	case CAPSRC_START:
+	    if (!capturing)
+		kill(getpid(), SIGINT);         // The ring
+	    lost = 0;
+	    break;
+	case CAPSRC_XRUN:
+	    fprintf(stderr, "Xrun: %u frames lost\n", capplay->ev.frames);
+	    lost += capplay->ev.frames;         // Before the next block
+	    xruns++;
+	    break;
+	case CAPSRC_READ:
+	    while (capturing && buf_ready)      // Still decoding the previous block
+		usleep(100);
+	    if (!capturing || capplay->ev.bytes != pcm_cap.size)
+		break;
+	    sem_wait(&mutex);
+	    if (bus)
+		buffer = audbus_claim(bus);
+	    memcpy(buffer, block, pcm_cap.size);
+	    if (bus)
+		audbus_publish(bus, capplay->ev.frames, capplay->ev.t_ns, lost);
+	    buf_gap = lost;
+	    lost = 0;
+	    buf_ready = 1;
+	    sem_post(&mutex);
+	    blocks++;
+	    break;
+	}
+    }
+
+    while (capturing && buf_ready)              // Let the last block be decoded
+	usleep(1000);
+    fprintf(stdout, "Replayed %u blocks and %u xruns, latest block %.1f ms behind\n", blocks,
+	    xruns, capplay->late_ns / 1e6);
+    if (res < 0)
+	fprintf(stderr, "Capture recording is corrupt\n");
+    audbus_close(bus);                          // The readers see the end
+    exit(res < 0 ? EXIT_FAILURE : 0);
+}
+
 
 /**@brief Demodulate Caller ID 
  *
@@ -461,17 +924,49 @@ int main(int argc, char *argv[])
     unsigned int size_of_buf;
 
     int samp_rate = 44100;      // Default sampling rate
-    int baud_rate = 1200;       // Default baud rate
+    int baud_rate = FSK_BAUD;   // Default baud rate
     int bits = 16;              // Default sample size
+    int card = 1;               // Default sound card
 
     int res;
 
     param *demod_param;         // Storing the audio file parameters used for demosulation
+    resampler *rs = NULL;       // Converts samp_rate to CID_CANONICAL_RATE
+    short *rs_buf = NULL;       // Resampled samples passed for decoding
+    line_arena *arena;          // Buffers of the line
+    line_slot slot;             // Buffers of the line in the arena
+    struct canary_line cl;      // Virtual line of the canaries
+    int canary_s = 0;           // Seconds between two canaries, 0 for none
+    int budget_ms = CANARY_BUDGET_MS;   // Latency budget of the canaries
+    ctl_history hist;           // Samples captured before the line is armed
+    long long rd = 0;           // Next sample of the history to demodulate
+    long long pre;              // Pre-roll point of an arm command
+    long long until = 0;        // End of the demodulation of an armed line
+    long long ring_end;         // End of the ring, from the controller
+    int armed = 0;              // 1 while the line is armed
+    struct timeval now;
+    const char *ctl_path = NULL;        // Control socket, "%d" is the line
+    const char *replay_path = NULL;     // Soft bit cache replayed instead of decoding
+    const char *caprec_path = NULL;     // Capture recording to write
+    const char *bus_name = NULL;        // Audio bus published for other processes
+    int bus_replace = 0;        // Replace a bus of the same name (-F)
+    const char *pipe_spec = NULL;       // Stages of the line, else those of the profile
+    pipeline pl;                // Stages a block of the line goes through
+    int n;
+    unsigned int gap = 0;       // Frames lost by an xrun before the block
+    unsigned int hgap;          // Frames lost before the samples read from the history
+    int rs_len = 0;             // No. of resampled samples
+    int nsamp = 0;              // No. of single channel samples in buf
+    int combine = COMBINE_OFF;  // Diversity combining of the two channels
+    diversity div;              // State of the two channel combiner
     pcm_capture pcm_cap;        // Parameters for PCM capture
+    cid_profile prof;           // Configuration tuned for the host by cid_tune
     cid_data *data;
 
     sigset_t set;
     pthread_t pcm_thr;          // New thread to read message form the sound card
+    pthread_t cdr_thr;          // Writes the batch of the call store
+    pthread_t canary_thr;       // Runs the canaries on the virtual line
 
 #ifdef WAVFILE
 
@@ -479,6 +974,9 @@ int main(int argc, char *argv[])
     int off = 0;                // Offset pointing to current reading position in the file
     char file_name[30];	        // Sample File name
     struct stat sb;             // struct to store the file stats
+    int wav_channels = 1;       // No. of channels in the wav file
+    spillarc_reader *arc;       // Spill archive decoded instead of the wav file
+    unsigned char *wavbuf = NULL;       // Bytes of the wav file
 
     unsigned int samples = 0;
     if (argc < 2) {
@@ -491,27 +989,41 @@ int main(int argc, char *argv[])
 
     strcpy(file_name, argv[1]);
 
-    if ((fd_codec = open(file_name, O_RDONLY)) == -1) {
-	perror("opening device");
-	exit(EXIT_FAILURE);
-    }
+    if ((arc = spillarc_open(file_name))) {     // Mapped, decoded block by block
+	samp_rate = arc->hdr->rate;
+	fprintf(stdout, "Spill archive: %llu samples at %d Hz, decoder result %d\n",
+		(unsigned long long) arc->hdr->nsamples, samp_rate, arc->hdr->result);
+    } else {
+	if ((fd_codec = open(file_name, O_RDONLY)) == -1) {
+	    perror("opening device");
+	    exit(EXIT_FAILURE);
+	}
 
-    if (stat(argv[1], &sb) == -1) {     // Reading the file stats
-	perror("stat");
-	exit(EXIT_FAILURE);
-    }
-    unsigned char wavbuf[sb.st_size];   // Buffer to store the bytes of wav file.
-                                        // Read the data from the wav file to the buffer 
-    res = read(fd_codec, wavbuf, sizeof(wavbuf));
-    if (res <= 0)
-	fprintf(stderr, "\nSamples not Read\n");
+	if (stat(argv[1], &sb) == -1) { // Reading the file stats
+	    perror("stat");
+	    exit(EXIT_FAILURE);
+	}
+	if (!(wavbuf = malloc(sb.st_size))) {   // Buffer to store the bytes of wav file.
+	    perror("wav file");
+	    exit(EXIT_FAILURE);
+	}
+	                                // Read the data from the wav file to the buffer 
+	res = read(fd_codec, wavbuf, sb.st_size);
+	if (res <= 0)
+	    fprintf(stderr, "\nSamples not Read\n");
 
-    getHeader(wavbuf);                  // Getting the wav file information
+	samp_rate = getHeader(wavbuf, &wav_channels);   // Getting the wav file information
 
-    off = sizeof(wav_header);
+	off = sizeof(wav_header);
+    }
 
 #endif
 
+    setvbuf(stdout, NULL, _IOLBF, 0);           // Messages go out line by line to cid_super
+
+    profile_default(&prof);
+    profile_load(CID_PROFILE_PATH, &prof);      // The host profile is optional
+
     /* parse command line arguments */
     argv += 2;
     while (*argv) {
@@ -527,23 +1039,160 @@ int main(int argc, char *argv[])
 	    argv++;
 	    if (*argv)
 		baud_rate = atoi(*argv);
+	} else if (strcmp(*argv, "-L") == 0) {
+	    argv++;
+	    if (*argv && !(nlist = numlist_open(*argv))) {
+		fprintf(stderr, "Unable to open number list %s\n", *argv);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(*argv, "-C") == 0) {
+	    argv++;
+	    if (*argv && !(cnam = cnam_new(*argv))) {
+		fprintf(stderr, "Unable to start caller name lookups\n");
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(*argv, "-R") == 0) {
+	    argv++;
+	    if (*argv && !(cdr = cdr_open(*argv))) {
+		fprintf(stderr, "Unable to open call store %s\n", *argv);
+		exit(EXIT_FAILURE);
+	    }
+	    if (cdr)
+		atexit(cdr_exit);
+	} else if (strcmp(*argv, "-W") == 0) {
+	    argv++;
+	    if (*argv)
+		lp_path = *argv;
+	} else if (strcmp(*argv, "-K") == 0) {
+	    argv++;
+	    if (*argv)
+		canary_s = atoi(*argv);
+	} else if (strcmp(*argv, "-k") == 0) {
+	    argv++;
+	    if (*argv)
+		budget_ms = atoi(*argv);
+	} else if (strcmp(*argv, "-S") == 0) {
+	    argv++;
+	    if (*argv)
+		ctl_path = *argv;
+	} else if (strcmp(*argv, "-X") == 0) {
+	    argv++;
+	    if (*argv && !(sbw = softbit_create(*argv))) {
+		fprintf(stderr, "Unable to open soft bit cache %s\n", *argv);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(*argv, "-A") == 0) {
+	    argv++;
+	    if (*argv)
+		arc_dir = *argv;
+	} else if (strcmp(*argv, "-x") == 0) {
+	    argv++;
+	    if (*argv)
+		replay_path = *argv;
+#ifndef WAVFILE
+	} else if (strcmp(*argv, "-Y") == 0) {
+	    argv++;
+	    if (*argv)
+		caprec_path = *argv;
+	} else if (strcmp(*argv, "-y") == 0) {
+	    argv++;
+	    if (*argv && !(capplay = capsrc_open(*argv))) {
+		fprintf(stderr, "Unable to open capture recording %s\n", *argv);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(*argv, "-M") == 0) {
+	    argv++;
+	    if (*argv)
+		bus_name = *argv;
+	} else if (strcmp(*argv, "-F") == 0) {
+	    bus_replace = 1;
+#endif
+	} else if (strcmp(*argv, "-c") == 0) {
+	    argv++;
+	    if (*argv)
+		card = atoi(*argv);
+	} else if (strcmp(*argv, "-l") == 0) {
+	    argv++;
+	    if (*argv)
+		cid_line = atoi(*argv);
+	} else if (strcmp(*argv, "-P") == 0) {
+	    argv++;
+	    if (*argv && profile_load(*argv, &prof)) {
+		fprintf(stderr, "Unable to read host profile %s\n", *argv);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(*argv, "-G") == 0) {
+	    argv++;
+	    if (*argv)
+		pipe_spec = *argv;
+	} else if (strcmp(*argv, "-d") == 0) {
+	    argv++;
+	    if (*argv)
+		combine = (strcmp(*argv, "mrc") == 0) ? COMBINE_MRC :
+		    ((strcmp(*argv, "sel") == 0) ? COMBINE_SELECT : COMBINE_OFF);
 	}
 	if (*argv)
 	    argv++;
     }
 
+    if (capplay) {                              // Captured as recorded
+	samp_rate = capplay->hdr.rate;
+	bits = capplay->hdr.bits;
+	prof.period_size = capplay->hdr.period_size;
+	prof.period_count = capplay->hdr.period_count;
+	if (capplay->hdr.channels != 2) {
+	    fprintf(stderr, "Capture recording of %d channels, 2 expected\n", capplay->hdr.channels);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    /* The demodulator always runs at CID_CANONICAL_RATE, other rates are 
+       resampled before decoding */
+
     if ((demod_param = malloc(sizeof(*demod_param)))) {
-	demod_param->samp_rate = samp_rate;
+	demod_param->samp_rate = CID_CANONICAL_RATE;
 	demod_param->baud_rate = baud_rate;
-	demod_param->ispb = samp_rate / (float) baud_rate;
+	demod_param->ispb = CID_CANONICAL_RATE / (float) baud_rate;
+	demod_param->engine = prof.engine;
+	demod_param->seed = NULL;
+	if (lp_path) {
+	    if (lineparm_load(lp_path, cid_line, &lparm) == 0)
+		fprintf(stdout, "Line %d warm started from %u spills\n", cid_line, lparm.spills);
+	    demod_param->seed = &lparm;
+	}
+    }
+
+    if (arc_dir && !(arcw = spillarc_writer_new(samp_rate, SPILLARC_MAX_SEC * samp_rate))) {
+	fprintf(stderr, "Unable to archive the spills\n");
+	exit(EXIT_FAILURE);
     }
 
-    pcm_cap.card = 1;
+    if (ctl_path && !(ctl = ctl_open(ctl_path, cid_line))) {
+	fprintf(stderr, "Unable to open control socket %s\n", ctl_path);
+	exit(EXIT_FAILURE);
+    }
+
+    if (canary_s) {
+	cl.demod_param = *demod_param;
+	cl.demod_param.seed = NULL;
+	cl.cid_signalling = cid_signalling;
+	cl.rate = samp_rate;
+	cl.rs = NULL;
+	if (!(can = malloc(sizeof(*can))) ||
+	    canary_init(can, canary_s * 1000, budget_ms, samp_rate, baud_rate) ||
+	    (samp_rate != CID_CANONICAL_RATE && !(cl.rs = resampler_new(samp_rate, CID_CANONICAL_RATE)))) {
+	    fprintf(stderr, "Unable to start the canaries\n");
+	    exit(EXIT_FAILURE);
+	}
+	fprintf(stdout, "Canary every %d s on line %d, budget %d ms\n", canary_s, CANARY_LINE, budget_ms);
+    }
+
+    pcm_cap.card = card;
     pcm_cap.device = 0;
     pcm_cap.channels = 2;
     pcm_cap.rate = samp_rate;
-    pcm_cap.period_size = 1024;
-    pcm_cap.period_count = 4;
+    pcm_cap.period_size = prof.period_size;
+    pcm_cap.period_count = prof.period_count;
     pcm_cap.size = (pcm_cap.channels * pcm_cap.period_size * 
 			pcm_cap.period_count * (bits / 8));
 
@@ -562,24 +1211,84 @@ int main(int argc, char *argv[])
 	exit(EXIT_FAILURE);
     }
 
+    if (combine != COMBINE_OFF && bits != 16) {
+	fprintf(stderr, "Diversity combining needs 16 bits samples.\n");
+	exit(EXIT_FAILURE);
+    }
+    diversity_init(&div, combine);
+
+    if (caprec_path && !(caprec = capsrc_create(caprec_path, samp_rate, pcm_cap.channels, bits,
+						pcm_cap.period_size, pcm_cap.period_count))) {
+	fprintf(stderr, "Unable to open capture recording %s\n", caprec_path);
+	exit(EXIT_FAILURE);
+    }
+
+    if (bus_name) {
+	if (!ctl) {                             // The rings capture 4 s windows only
+	    fprintf(stderr, "The audio bus needs the continuous capture of -S\n");
+	    exit(EXIT_FAILURE);
+	}
+	if (!(bus = audbus_create(bus_name, samp_rate, pcm_cap.channels, bits, pcm_cap.size,
+				  bus_replace))) {
+	    fprintf(stderr, "Unable to create audio bus %s: %s%s\n", bus_name, strerror(errno),
+		    (errno == EEXIST) ? ", -F replaces it" : "");
+	    exit(EXIT_FAILURE);
+	}
+	audbus_report(bus, stdout);
+    }
+
     size_of_buf = pcm_cap.size / (bits / 8);
-    unsigned char buf[size_of_buf];     // Buffer containing audio samples which is passed 
+    unsigned char *buf;                 // Buffer containing audio samples which is passed 
                                         // for decoding the CID message
 
-    buffer = malloc(pcm_cap.size);
-    if (!buffer) {
-	fprintf(stderr, "Unable to allocate %d bytes\n", pcm_cap.size);
+    if (samp_rate != CID_CANONICAL_RATE) {
+	if (!(rs = resampler_new(samp_rate, CID_CANONICAL_RATE))) {
+	    fprintf(stderr, "Unable to resample %d Hz\n", samp_rate);
+	    exit(EXIT_FAILURE);
+	}
+	rs_len = resampler_out_len(rs, size_of_buf / 2);
+	fprintf(stdout, "Resampling %d Hz to %d Hz\n", samp_rate, CID_CANONICAL_RATE);
+    }
+
+    /* The state, message and samples of the line (and of the virtual line of
+       the canaries) are carved out of the arena, the demodulator scratch holds
+       the new samples and the ones carried over */
+
+    n = (rs_len > (int) size_of_buf / 2) ? rs_len : (int) size_of_buf / 2;
+    if (!(arena = line_arena_new(can ? 2 : 1, (size_of_buf + 1) / 2, rs_len, n + CID_OLDSTUFF,
+				 ctl ? CTL_HISTORY_MS * samp_rate / 1000 : 0))) {
+	perror("Line arena");
 	exit(EXIT_FAILURE);
     }
-                                        // Create a callerID state machine
-    if ((cs = callerid_new(cid_signalling, demod_param)) == NULL) {
-	perror("callerID state machine");
+    line_arena_report(arena, stdout);
+    line_arena_slot(arena, 0, &slot);
+    buf = (unsigned char *) slot.ring;
+    rs_buf = slot.rs;
+    if (ctl)
+	ctl_history_init(&hist, slot.hist, arena->hist_len, samp_rate);
+
+    /* With a bus, every period is captured into a slot claimed from it */
+    if (!bus && !(buffer = malloc(pcm_cap.size))) {
+	fprintf(stderr, "Unable to allocate %d bytes\n", pcm_cap.size);
 	exit(EXIT_FAILURE);
     }
-
-    if (!(data = malloc(sizeof(cid_data)))) {
-	perror("Data malloc fail");
+    line_start(arena, &slot, cid_signalling, demod_param);     // Create a callerID state machine
+    cs = slot.cs;
+    data = slot.data;
+    if (pipeline_init(&pl, pipe_spec ? pipe_spec : prof.pipeline, cs, rs, rs_buf, arcw))
 	exit(EXIT_FAILURE);
+    pipeline_report(&pl, stdout);
+    if (replay_path)
+	exit(replay_spills(arena, &slot, cid_signalling, demod_param, replay_path) ?
+	     EXIT_FAILURE : 0);
+    spill_begin();
+    if (can) {                                  // Same stages as the line
+	cl.arena = arena;
+	line_arena_slot(arena, 1, &cl.slot);
+	line_start(arena, &cl.slot, cid_signalling, &cl.demod_param);
+	if (pipeline_init(&cl.pl, pipe_spec ? pipe_spec : prof.pipeline, cl.slot.cs, cl.rs,
+			  cl.slot.rs, NULL))
+	    exit(EXIT_FAILURE);
     }
 
     sem_init(&mutex, 0, 0);                     // Initialize the semaphore
@@ -590,7 +1299,16 @@ int main(int argc, char *argv[])
 
     // Create a pthread to read audio samples from the sound card
     if (pthread_create
-	(&pcm_thr, NULL, (void *) &capture_sample, (void *) &pcm_cap)) {
+	(&pcm_thr, NULL, capplay ? (void *) &replay_sample : (void *) &capture_sample,
+	 (void *) &pcm_cap)) {
+	perror("Pthread failed");
+	exit(EXIT_FAILURE);
+    }
+    if (cdr && pthread_create(&cdr_thr, NULL, cdr_flusher, NULL)) {
+	perror("Pthread failed");
+	exit(EXIT_FAILURE);
+    }
+    if (can && pthread_create(&canary_thr, NULL, canary_thread, &cl)) {
 	perror("Pthread failed");
 	exit(EXIT_FAILURE);
     }
@@ -601,78 +1319,152 @@ int main(int argc, char *argv[])
 
     signal(SIGINT, signal_handler);
     signal(SIGTSTP, sigkill_handler);
+    signal(SIGTERM, sigkill_handler);           // Stop of cid_super, the call store is flushed
+    signal(SIGUSR1, sigusr1_handler);
 
-    fprintf(stdout, "Waiting for RING interrupt,...(press ctrl-C)\n");
+    if (ctl) {                                  // Capture all the time, the controller arms the line
+	fprintf(stdout, "Waiting for the line to be armed on %s\n", ctl->addr.sun_path);
+#ifdef WAVFILE
+	buf_ready = 1;
+#else
+	capturing = 1;
+#endif
+	sem_post(&mutex);
+    } else
+	fprintf(stdout, "Waiting for RING interrupt,...(press ctrl-C)\n");
 
     while (1) {
+	if (quit) {
+	    fprintf(stdout, "Program terminated\n");
+	    exit(0);
+	}
 	if (buf_ready) {
 	    sem_wait(&mutex);
 
 	    int i;
 #ifdef WAVFILE
-	    for (i = 0; i < size_of_buf; i++) {
-		buf[i] = wavbuf[off + i];
-	    }
-	    samples += size_of_buf;
-	    off += size_of_buf;
+	    if (arc) {                          // Decoded straight into the block
+		if ((nsamp = spillarc_read(arc, (short *) buf, size_of_buf / 2)) <= 0) {
+		    spill_end(0);
+		    exit(nsamp ? EXIT_FAILURE : 0);
+		}
+		memset(buf + nsamp * 2, 0, size_of_buf - nsamp * 2);
+		nsamp = size_of_buf / 2;
+	    } else {
+		for (i = 0; i < size_of_buf; i++) {
+		    buf[i] = wavbuf[off + i];
+		}
+		samples += size_of_buf;
+		off += size_of_buf;
 
-	    if (samples > sb.st_size)
-		exit(0);
+		if (samples > sb.st_size) {
+		    spill_end(0);               // Keep the spill cut by the end of the file
+		    exit(0);
+		}
+
+		nsamp = size_of_buf / 2;
+		if (wav_channels == 2)          // Stereo file, combine the two channels
+		    nsamp = diversity_combine(&div, (short *) buf, nsamp / 2, (short *) buf);
+	    }
+	    if (ctl)                            // Played in real time, as a sound card would
+		usleep(1000000LL * nsamp / samp_rate);
 #else
 	    int j;
 
 	    /* In interleaved format with multiple channels, data stored in buffer 
 	       is of the format RRLLRRLL (16bits), RRRLLLRRRLLL (24bits) */
 
-	    for (i = 0; i < size_of_buf; i += (bits / 8)) {
-		for (j = 0; j < (bits / 8); j++) {
-		    buf[i + j] = buffer[i * (bits / 8) + j];
+	    if (combine != COMBINE_OFF)
+		nsamp = diversity_combine(&div, (short *) buffer, size_of_buf / 2, (short *) buf);
+	    else {
+		for (i = 0; i < size_of_buf; i += (bits / 8)) {
+		    for (j = 0; j < (bits / 8); j++) {
+			buf[i + j] = buffer[i * (bits / 8) + j];
+		    }
 		}
+		nsamp = size_of_buf / 2;
 	    }
+	    gap = buf_gap;
+	    buf_gap = 0;
 #endif
 
 	    /* Checking for Caller ID standard and calling functions to decode CID */
-	    if (cid_signalling == CID_SIG_V23)
-		res = callerid_feed(cs, buf, (size_of_buf));
+	    if (cid_signalling == CID_SIG_V23) {
+		if (ctl) {
+		    gettimeofday(&now, NULL);
+		    if (gap)                    // Concealed when the history is read
+			ctl_history_gap(&hist, gap);
+		    ctl_history_put(&hist, (short *) buf, nsamp, now.tv_sec * 1000000LL + now.tv_usec);
+		    if (ctl_poll(ctl, &ring_end)) {     // Start from the pre-roll point
+			if ((pre = ctl_history_at(&hist, ring_end - CTL_PREROLL_MS * 1000LL)) < 0)
+			    fprintf(stderr, "Line %d not armed, the ring is older than the history\n",
+				    cid_line);
+			else {
+			    rd = pre;
+			    until = ctl_history_at(&hist, ring_end) + (long long) CTL_ARM_MS * samp_rate / 1000;
+			    line_start(arena, &slot, cid_signalling, demod_param);
+			    spill_begin();
+			    armed = 1;
+			    fprintf(stdout, "Line %d armed, demodulating from %.0f ms ago\n", cid_line,
+				    (hist.count - rd) * 1000.0 / samp_rate);
+			}
+		    }
+
+		    /* Idle until armed, then catch up with the history */
+		    res = 0;
+		    while (armed && !res &&
+			   (nsamp = ctl_history_get(&hist, &rd, (short *) buf, arena->ring_len, &hgap)) > 0) {
+			res = hgap ? feed_gap(cs, rs, hgap) : 0;
+			if (!res)
+			    res = pipeline_run(&pl, (short *) buf, nsamp);
+		    }
+		    if (armed && !res && rd >= until)
+			res = -1;                       // No message after the ring
+		    if (res)
+			armed = 0;
+		} else {
+		    if (ring_pending) {         // Nothing of the last window is archived
+			ring_pending = 0;
+			spill_begin();
+		    }
+		    res = gap ? feed_gap(cs, rs, gap) : 0;
+		    if (!res)
+			res = pipeline_run(&pl, (short *) buf, nsamp);
+		}
+	    }
 	    else {
 		/* call function to decode DTMF */
 	    }
 
 	    if (res < 0) {
 		fprintf(stderr, "\nFailed to Decode Caller ID\n");
-		callerid_free(cs);      // Free the data structure
-		free(data);             // Free the buffer
-
-		                        //Re-initialize the buffer
-		if (!(data = malloc(sizeof(cid_data)))) {
-		    perror("Data malloc fail");
-		    exit(EXIT_FAILURE);
-		}
+		spill_end(res);
 		                        //Re-intialize the CID structure
-		if ((cs =
-		     callerid_new(cid_signalling, demod_param)) == NULL) {
-		    perror("callerID state machine");
-		    exit(EXIT_FAILURE);
-		}
+		line_start(arena, &slot, cid_signalling, demod_param);
 	    } else if (res) {
+		pthread_mutex_lock(&sink_lock);
+		if (nlist)
+		    numlist_refresh(nlist);     // Pick up a replaced list file
+		if (lp_path && lineparm_learn(&lparm, &cs->fskd) &&
+		    lineparm_save(lp_path, cid_line, &lparm))
+		    perror("Saving line parameters");
 		get_CID_info(cs, data); // Display CallerID message
-		callerid_free(cs);      // Free the data structure
-		free(data);             // Free the buffer
-
-		                        //Re-initialize the buffer
-		if (!(data = malloc(sizeof(cid_data)))) {
-		    perror("Data malloc fail");
-		    exit(EXIT_FAILURE);
-		}
+		if (cdr)
+		    save_CID_info(cs, cid_line);
+		pthread_mutex_unlock(&sink_lock);
+		spill_end(res);
 		                        //Re-intialize the CID structure
-		if ((cs =
-		     callerid_new(cid_signalling, demod_param)) == NULL) {
-		    perror("callerID state machine");
-		    exit(EXIT_FAILURE);
-		}
+		line_start(arena, &slot, cid_signalling, demod_param);
+	    }
+	    if (res)
+		spill_begin();
+
+	    if (pipe_dump) {
+		pipeline_report(&pl, stdout);
+		pipe_dump = 0;
 	    }
 
-	    fprintf(stderr, "Read %lu bytes\n", sizeof(buf));
+	    fprintf(stderr, "Read %u bytes\n", size_of_buf);
 
 #ifdef WAVFILE
 #else
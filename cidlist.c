@@ -0,0 +1,60 @@
+/**@file cidlist.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Builds and queries the block/allow number list
+ *
+ * Usage: ./cid_list build 'TXT' 'LIST'						<BR>
+ *        ./cid_list lookup 'LIST' 'NUMBER' ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "numlist.h"
+
+#define LOOKUP_LOOPS            1000000 // Lookups timed per number
+
+int main(int argc, char *argv[])
+{
+    numlist *nl;
+    struct timespec t0, t1;
+    int i, n, verdict = 0;
+    double ns;
+
+    if (argc >= 4 && strcmp(argv[1], "build") == 0) {
+	if ((n = numlist_build(argv[2], argv[3])) < 0) {
+	    fprintf(stderr, "Unable to build %s\n", argv[3]);
+	    return EXIT_FAILURE;
+	}
+	printf("%d entries written to %s\n", n, argv[3]);
+	return 0;
+    }
+
+    if (argc < 4 || strcmp(argv[1], "lookup")) {
+	printf("Usage: ./cid_list build 'TXT' 'LIST'\n");
+	printf("       ./cid_list lookup 'LIST' 'NUMBER' ...\n");
+	printf("TXT : one number per line followed by block or allow, '*' at the end for a prefix\n");
+	return 0;
+    }
+
+    if (!(nl = numlist_open(argv[2]))) {
+	fprintf(stderr, "Unable to open %s\n", argv[2]);
+	return EXIT_FAILURE;
+    }
+
+    for (argv += 3; *argv; argv++) {
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < LOOKUP_LOOPS; i++)
+	    verdict = numlist_lookup(nl, *argv);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / LOOKUP_LOOPS;
+	printf("%s %s (%.1f ns)\n", *argv, numlist_verdict_name(verdict), ns);
+    }
+
+    numlist_close(nl);
+    return 0;
+}
@@ -0,0 +1,379 @@
+/**@file cidsuper.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Runs the lines in several cid_fsk processes (shards)
+ *
+ * Usage: ./cid_super [-x 'CID_FSK'] [-m 'SECS'] [-v] 'LINE:SOURCE'... [-- 'OPTIONS']	<BR>
+ *
+ * Every LINE:SOURCE is a shard, run as					<BR>
+ *      CID_FSK SOURCE -c SOURCE -l LINE OPTIONS			<BR>
+ * where SOURCE is the sound card of the line (or the recording, for a
+ * wavfile build) and OPTIONS are passed to every shard. A bad recording or
+ * a driver fault only takes down the shard of its line: a shard killed by a
+ * signal or exiting with an error is started again, after a delay doubling
+ * from SUPER_MIN_DELAY to SUPER_MAX_DELAY while it keeps crashing. A shard
+ * exiting normally is done.
+ *
+ * The shards are pinned one per core. Their decoded messages are merged
+ * into one stream, every line prefixed with the line of the shard, and the
+ * metrics of all the shards are printed every SECS seconds, on SIGUSR1 and
+ * when the last shard is done. SIGINT and SIGTERM stop every shard with
+ * SIGTERM, on which cid_fsk writes its call records and exits. The shards
+ * run in sessions of their own, so a Ctrl-C on the terminal only reaches
+ * the supervisor.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define SUPER_MAX_SHARDS        64      ///< Max. no. of shards
+#define SUPER_MAX_ARGS          64      ///< Max. no. of options passed to the shards
+#define SUPER_LINE_LEN          256     ///< Longest output line of a shard
+#define SUPER_MIN_DELAY         1       ///< Restart delay after a crash, seconds
+#define SUPER_MAX_DELAY         60      ///< Longest restart delay, seconds
+#define SUPER_STABLE            60      ///< A shard up this long is not crashing, seconds
+
+/// Output of a shard, split in lines
+struct shard_out {
+	int fd;                         ///< Read end of the pipe, -1 once closed
+	char buf[SUPER_LINE_LEN];       ///< Incomplete line
+	int len;                        ///< Bytes in buf
+};
+
+/// One cid_fsk process and its metrics
+struct shard {
+	int line;                       ///< Line decoded by the shard
+	const char *source;             ///< Sound card or recording of the line
+	pid_t pid;                      ///< Process, 0 when not running
+	struct shard_out out;           ///< Decoded messages (stdout)
+	struct shard_out err;           ///< Diagnostics (stderr)
+	time_t started;                 ///< Start of the current process
+	time_t restart_at;              ///< When to start it again, 0 if not pending
+	int delay;                      ///< Next restart delay, seconds
+	int done;                       ///< 1 once the shard exited normally
+
+	unsigned int starts;            ///< Processes started
+	unsigned int crashes;           ///< Processes killed by a signal or failed
+	unsigned int passed;            ///< Messages with a good checksum
+	unsigned int failed;            ///< Messages with a bad checksum or lost
+	unsigned int blocked;           ///< Numbers blocked by the number list
+};
+
+static struct shard shards[SUPER_MAX_SHARDS];
+static int nshards;
+static const char *cid_fsk = "./cid_fsk";
+static char *options[SUPER_MAX_ARGS];
+static int noptions;
+static int verbose;
+
+static volatile sig_atomic_t stopping, report;
+
+static void stop_handler(int sig)
+{
+    stopping = 1;
+}
+
+static void report_handler(int sig)
+{
+    report = 1;
+}
+
+/**@brief Start the process of a shard
+ * @param s shard
+ * @return 0 if successful else -1 if error
+ */
+static int shard_start(struct shard *s)
+{
+    int out[2], err[2];
+    char line[16];
+    char *argv[SUPER_MAX_ARGS + 8];
+    cpu_set_t cpus;
+    int i, n = 0;
+
+    if (pipe(out) < 0)
+	return -1;
+    if (pipe(err) < 0) {
+	close(out[0]);
+	close(out[1]);
+	return -1;
+    }
+
+    if ((s->pid = fork()) < 0) {
+	close(out[0]);
+	close(out[1]);
+	close(err[0]);
+	close(err[1]);
+	s->pid = 0;
+	return -1;
+    }
+
+    if (s->pid == 0) {                          // Shard
+	dup2(out[1], STDOUT_FILENO);
+	dup2(err[1], STDERR_FILENO);
+	close(out[0]);
+	close(out[1]);
+	close(err[0]);
+	close(err[1]);
+	setsid();                               // Out of the terminal, Ctrl-C is not a RING
+
+	CPU_ZERO(&cpus);                        // One core per shard
+	CPU_SET((s - shards) % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+
+	snprintf(line, sizeof(line), "%d", s->line);
+	argv[n++] = (char *) cid_fsk;
+	argv[n++] = (char *) s->source;
+	argv[n++] = "-c";
+	argv[n++] = (char *) s->source;
+	argv[n++] = "-l";
+	argv[n++] = line;
+	for (i = 0; i < noptions; i++)
+	    argv[n++] = options[i];
+	argv[n] = NULL;
+
+	execv(cid_fsk, argv);
+	perror(cid_fsk);
+	_exit(127);
+    }
+
+    close(out[1]);
+    close(err[1]);
+    s->out.fd = out[0];
+    s->out.len = 0;
+    s->err.fd = err[0];
+    s->err.len = 0;
+    s->started = time(NULL);
+    s->restart_at = 0;
+    s->starts++;
+    return 0;
+}
+
+/**@brief Account a complete output line of a shard
+ * @param s shard
+ * @param o output the line comes from
+ * @param text line, without the newline
+ */
+static void shard_line(struct shard *s, struct shard_out *o, const char *text)
+{
+    if (strstr(text, "Checksum Passed"))
+	s->passed++;
+    else if (strstr(text, "Checksum Failed") || strstr(text, "Failed to Decode"))
+	s->failed++;
+    else if (strstr(text, "Verdict: BLOCK"))
+	s->blocked++;
+
+    if (o == &s->out || verbose)
+	printf("line %d: %s\n", s->line, text);
+}
+
+/**@brief Read the output of a shard and split it in lines
+ * @param s shard
+ * @param o output to read
+ */
+static void shard_read(struct shard *s, struct shard_out *o)
+{
+    char *nl;
+    int n;
+
+    n = read(o->fd, o->buf + o->len, sizeof(o->buf) - 1 - o->len);
+    if (n <= 0) {                               // Process exited, flush the last line
+	if (o->len) {
+	    o->buf[o->len] = 0;
+	    shard_line(s, o, o->buf);
+	}
+	close(o->fd);
+	o->fd = -1;
+	o->len = 0;
+	return;
+    }
+
+    o->len += n;
+    o->buf[o->len] = 0;
+    while ((nl = strchr(o->buf, '\n'))) {
+	*nl = 0;
+	if (nl > o->buf)
+	    shard_line(s, o, o->buf);
+	o->len -= nl + 1 - o->buf;
+	memmove(o->buf, nl + 1, o->len + 1);
+    }
+    if (o->len == sizeof(o->buf) - 1) {         // Too long, cut it
+	shard_line(s, o, o->buf);
+	o->len = 0;
+    }
+}
+
+/**@brief Reap a shard whose output is closed, and schedule its restart
+ * @param s shard
+ */
+static void shard_reap(struct shard *s)
+{
+    int status;
+    time_t now = time(NULL);
+
+    if (waitpid(s->pid, &status, 0) < 0)
+	return;
+    s->pid = 0;
+
+    if (stopping || (WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+	s->done = 1;
+	return;
+    }
+
+    s->crashes++;
+    if (now - s->started >= SUPER_STABLE)
+	s->delay = SUPER_MIN_DELAY;
+    s->restart_at = now + s->delay;
+    if (WIFSIGNALED(status))
+	fprintf(stderr, "line %d: shard killed by signal %d, restart in %d s\n",
+		s->line, WTERMSIG(status), s->delay);
+    else
+	fprintf(stderr, "line %d: shard exited with %d, restart in %d s\n",
+		s->line, WEXITSTATUS(status), s->delay);
+    s->delay = (s->delay * 2 > SUPER_MAX_DELAY) ? SUPER_MAX_DELAY : s->delay * 2;
+}
+
+/**@brief Print the metrics of every shard and their total */
+static void print_metrics(void)
+{
+    unsigned int starts = 0, crashes = 0, passed = 0, failed = 0, blocked = 0;
+    int i;
+
+    printf("%6s %8s %7s %7s %7s %7s %7s\n", "line", "pid", "starts", "crashes",
+	   "passed", "failed", "blocked");
+    for (i = 0; i < nshards; i++) {
+	struct shard *s = &shards[i];
+
+	printf("%6d %8d %7u %7u %7u %7u %7u\n", s->line, (int) s->pid, s->starts,
+	       s->crashes, s->passed, s->failed, s->blocked);
+	starts += s->starts;
+	crashes += s->crashes;
+	passed += s->passed;
+	failed += s->failed;
+	blocked += s->blocked;
+    }
+    printf("%6s %8s %7u %7u %7u %7u %7u\n", "total", "", starts, crashes, passed,
+	   failed, blocked);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    struct pollfd pfd[2 * SUPER_MAX_SHARDS];
+    struct shard_out *po[2 * SUPER_MAX_SHARDS];
+    struct shard *ps[2 * SUPER_MAX_SHARDS];
+    int period = 0;             // Seconds between the metrics, 0 for none
+    time_t next_report = 0;
+    int i, n, running;
+    char *colon;
+
+    /* parse command line arguments */
+    for (argv++; *argv; argv++) {
+	if (strcmp(*argv, "-x") == 0 && argv[1])
+	    cid_fsk = *++argv;
+	else if (strcmp(*argv, "-m") == 0 && argv[1])
+	    period = atoi(*++argv);
+	else if (strcmp(*argv, "-v") == 0)
+	    verbose = 1;
+	else if (strcmp(*argv, "--") == 0) {
+	    for (argv++; *argv && noptions < SUPER_MAX_ARGS; argv++)
+		options[noptions++] = *argv;
+	    break;
+	} else if ((colon = strchr(*argv, ':')) && nshards < SUPER_MAX_SHARDS) {
+	    *colon = 0;
+	    shards[nshards].line = atoi(*argv);
+	    shards[nshards].source = colon + 1;
+	    shards[nshards].out.fd = -1;          // No process yet
+	    shards[nshards].err.fd = -1;
+	    shards[nshards].delay = SUPER_MIN_DELAY;
+	    nshards++;
+	} else {
+	    fprintf(stderr, "Unknown shard %s\n", *argv);
+	    return EXIT_FAILURE;
+	}
+    }
+
+    if (!nshards) {
+	printf("Usage: ./cid_super [-x 'CID_FSK'] [-m 'SECS'] [-v] 'LINE:SOURCE'... [-- 'OPTIONS']\n");
+	return 0;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    signal(SIGUSR1, report_handler);
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (i = 0; i < nshards; i++)
+	if (shard_start(&shards[i])) {
+	    perror("Starting shard");
+	    shards[i].restart_at = time(NULL) + shards[i].delay;
+	}
+    if (period)
+	next_report = time(NULL) + period;
+
+    while (1) {
+	time_t now = time(NULL);
+
+	if (stopping == 1) {                    // Stop every shard, then reap them below
+	    for (i = 0; i < nshards; i++) {
+		if (shards[i].pid)
+		    kill(shards[i].pid, SIGTERM);  // SIGINT is the RING of cid_fsk
+		shards[i].restart_at = 0;
+	    }
+	    stopping = 2;
+	}
+
+	running = 0;
+	for (i = n = 0; i < nshards; i++) {
+	    struct shard *s = &shards[i];
+
+	    if (s->restart_at && now >= s->restart_at && shard_start(s))
+		s->restart_at = now + s->delay;
+	    if (s->pid && s->out.fd < 0 && s->err.fd < 0)
+		shard_reap(s);
+	    if (s->pid || s->restart_at)
+		running++;
+
+	    if (s->out.fd >= 0) {
+		pfd[n].fd = s->out.fd;
+		pfd[n].events = POLLIN;
+		po[n] = &s->out;
+		ps[n++] = s;
+	    }
+	    if (s->err.fd >= 0) {
+		pfd[n].fd = s->err.fd;
+		pfd[n].events = POLLIN;
+		po[n] = &s->err;
+		ps[n++] = s;
+	    }
+	}
+
+	if (report || (period && now >= next_report)) {
+	    print_metrics();
+	    report = 0;
+	    if (period)
+		next_report = now + period;
+	}
+	if (!running)
+	    break;
+
+	if (poll(pfd, n, 1000) > 0)
+	    for (i = 0; i < n; i++)
+		if (pfd[i].revents)
+		    shard_read(ps[i], po[i]);
+    }
+
+    print_metrics();
+    return 0;
+}
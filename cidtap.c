@@ -0,0 +1,107 @@
+/**@file cidtap.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Records the audio of the line from the audio bus of cid_fsk
+ *
+ * Usage: ./cid_tap 'BUS' 'FN' ['SECONDS']					<BR>
+ *
+ * A subscriber of the bus published by cid_fsk -M 'BUS', see audbus.c. The
+ * periods are written to the wav file FN as they come, from the bus, until
+ * cid_fsk closes it, SECONDS have been recorded or ctrl-C.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "fskmodem.h"
+#include "ciddeco.h"
+#include "audbus.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void stop_handler(int sig)
+{
+    stop = 1;
+}
+
+/**@brief Write the wav file header for the recorded samples */
+static void put_header(FILE * fp, const struct audbus_header *h, unsigned int bytes)
+{
+    wav_header wh;
+
+    memcpy(wh.chunk_id, "RIFF", 4);
+    wh.chunk_size = 36 + bytes;
+    memcpy(wh.format, "WAVE", 4);
+    memcpy(wh.fmtchunk_id, "fmt ", 4);
+    wh.fmtchunk_size = 16;
+    wh.audio_format = 1;
+    wh.num_channels = h->channels;
+    wh.sample_rate = h->rate;
+    wh.byte_rate = h->rate * h->channels * (h->bits / 8);
+    wh.block_align = h->channels * (h->bits / 8);
+    wh.bps = h->bits;
+    memcpy(wh.datachunk_id, "data", 4);
+    wh.datachunk_size = bytes;
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&wh, sizeof(wh), 1, fp);
+    fseek(fp, 0, SEEK_END);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct audbus_slot *slot;
+    const void *p;
+    audbus *b;
+    FILE *fp;
+    unsigned long long frames = 0, max = 0, lost = 0;
+    unsigned int bytes = 0, torn = 0, n, n_lost;
+
+    if (argc < 3) {
+	printf("Usage: ./cid_tap 'BUS' 'FN' ['SECONDS']\n");
+	return 0;
+    }
+    if (!(b = audbus_attach(argv[1]))) {
+	fprintf(stderr, "Unable to attach to audio bus %s\n", argv[1]);
+	exit(EXIT_FAILURE);
+    }
+    if (!(fp = fopen(argv[2], "wb"))) {
+	perror("opening output file");
+	exit(EXIT_FAILURE);
+    }
+    audbus_report(b, stdout);
+    put_header(fp, b->hdr, 0);
+    if (argc > 3)
+	max = atof(argv[3]) * b->hdr->rate;
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    while (!stop && (!max || frames < max)) {
+	if (!(p = audbus_next(b, &slot))) {
+	    if (b->hdr->closed)
+		break;                          // cid_fsk left
+	    continue;
+	}
+	fwrite(p, 1, b->hdr->period_bytes, fp);
+	n = slot->frames;                       // Checked with the samples
+	n_lost = slot->lost;
+	if (audbus_done(b)) {                   // Overwritten while written out,
+	    fseek(fp, -(long) b->hdr->period_bytes, SEEK_CUR);  // dropped
+	    torn++;
+	} else {
+	    frames += n;
+	    lost += n_lost;
+	    bytes += b->hdr->period_bytes;
+	}
+    }
+
+    put_header(fp, b->hdr, bytes);
+    fclose(fp);
+    printf("Recorded %llu frames, %llu lost by xruns, %u periods torn\n", frames, lost, torn);
+    audbus_report(b, stdout);
+    audbus_close(b);
+    return 0;
+}
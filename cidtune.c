@@ -0,0 +1,315 @@
+/**@file cidtune.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Benchmarks the decoder configurations and writes the host profile
+ *
+ * Synthetic spills are modulated with fsktx.c at the internal rate. Every
+ * configuration (demodulation engine and block size) first has to decode all
+ * of them, and every wav file given on the command line to the same bytes as
+ * the reference engine at the default block size. The blocks are fed the way
+ * cid_fsk does, resampled and with the samples left over carried to the next
+ * block. The configurations passing are timed on the same feed loop, block
+ * by block from the capture to the bytes, and the fastest one is written to
+ * the host profile, which cid_fsk reads at startup.
+ *
+ * Usage: ./cid_tune [-o 'PROFILE'] [-v] ['FN' ...]				<BR>
+ * PROFILE : profile to write, CID_PROFILE_PATH by default			<BR>
+ * FN : wav files (16 bits, mono) of the accuracy corpus
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fskmodem.h"
+#include "ciddeco.h"
+#include "fsktx.h"
+#include "resample.h"
+#include "profile.h"
+
+#define TUNE_SPILLS             6       // Synthetic spills of the accuracy check
+#define TUNE_ROUNDS             5       // Timing rounds, the fastest one is kept
+#define TUNE_GUARD_MS           200     // Silence before and after every spill
+#define TUNE_TIE                1.03    // Larger blocks have to be 3% faster to win
+#define TUNE_MAX_BYTES          TX_MAX_MSG
+#define TUNE_ISPB               ((float) CID_CANONICAL_RATE / FSK_BAUD)        // Samples per bit
+
+/// Samples of one spill or corpus file and the bytes it has to decode to
+struct tune_signal {
+    short *samples;
+    int len;
+    int rate;
+    unsigned char msg[TUNE_MAX_BYTES];
+    int msg_len;
+    const char *path;           // Corpus file, NULL for a synthetic spill
+};
+
+static const int block_sizes[] = { 64, 128, 256, 512, 1024, 2048, 4096 };
+
+static const char *tune_numbers[TUNE_SPILLS] = {
+    "9987654321", "8901234567", "3214567890", "8002404637", "5550100", "01632960123"
+};
+static const char *tune_names[TUNE_SPILLS] = {
+    "John Smith", "Susan Jones", "ABC Inc.", "CallerID.com", NULL, "O'Brien Pat"
+};
+
+static int verbose = 0;
+
+/**@brief Decode the bytes of a signal with a configuration
+ *
+ * The whole signal is fed, the bytes after the first max ones are not kept.
+ *
+ * @param sig signal to decode
+ * @param engine demodulation engine
+ * @param block frames of the capture buffer, decoded together
+ * @param out decoded bytes
+ * @param max no. of bytes to decode
+ * @param ns set to the nano seconds spent feeding the blocks, NULL if not timed
+ * @return no. of bytes decoded, -1 if out of memory
+ */
+static int tune_decode(const struct tune_signal *sig, int engine, int block,
+		       unsigned char *out, int max, long long *ns)
+{
+    fsk_data fskd;
+    resampler *rs = NULL;
+    struct timespec t0, t1;
+    short *work, *buf;
+    int off, nin, end = 0, mylen = 0, olen, b, n = 0;
+    int err, null;
+
+    if (sig->rate != CID_CANONICAL_RATE && !(rs = resampler_new(sig->rate, CID_CANONICAL_RATE)))
+	return -1;
+    if (!(work = malloc((rs ? resampler_out_len(rs, sig->len) + block * 4 : sig->len) * sizeof(short)))) {
+	if (rs)
+	    resampler_free(rs);
+	return -1;
+    }
+
+    err = dup(2);
+    null = open("/dev/null", O_WRONLY);
+    if (!verbose && null >= 0)          // The bit trace of fsk_serial() is not wanted here
+	dup2(null, 2);
+
+    fsk_line_init(&fskd, TUNE_ISPB, CID_SIG_V23, engine);
+    buf = work;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (off = 0; off < sig->len; off += nin) {
+	nin = (sig->len - off < block) ? sig->len - off : block;
+	if (rs)                         // New block appended after the samples left over
+	    end += resampler_process(rs, sig->samples + off, nin, work + end);
+	else {
+	    memcpy(work + end, sig->samples + off, nin * sizeof(short));
+	    end += nin;
+	}
+
+	mylen = work + end - buf;
+	while (mylen >= fskd.ispb * FSK_FRAME_BITS) {
+	    olen = mylen;
+	    if (fsk_serial(&fskd, buf, &mylen, &b) && n < max)
+		out[n++] = b;
+	    buf += (olen - mylen);
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (ns)
+	*ns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+
+    free(work);
+    if (rs)
+	resampler_free(rs);
+    fflush(stderr);
+    dup2(err, 2);
+    close(err);
+    if (null >= 0)
+	close(null);
+    return n;
+}
+
+/**@brief Time a configuration on the feed loop of tune_decode()
+ * @param sig signals to decode
+ * @param nsig no. of signals
+ * @param engine demodulation engine
+ * @param block frames of the capture buffer
+ * @return nano seconds per sample of the fastest round
+ */
+static double tune_time(const struct tune_signal *sig, int nsig, int engine, int block)
+{
+    unsigned char out[TUNE_MAX_BYTES];
+    long long t, total_ns, total;
+    int r, i;
+    double ns, best = 0;
+
+    for (r = 0; r < TUNE_ROUNDS; r++) {
+	for (i = 0, total_ns = 0, total = 0; i < nsig; i++) {
+	    tune_decode(&sig[i], engine, block, out, sig[i].msg_len, &t);
+	    total_ns += t;
+	    total += sig[i].len;
+	}
+	ns = (double) total_ns / total;
+	if (r == 0 || ns < best)
+	    best = ns;
+    }
+    return best;
+}
+
+/**@brief Modulate the synthetic spills
+ * @param sig signals to fill
+ * @return 0 if successful else -1 if error
+ */
+static int make_spills(struct tune_signal *sig)
+{
+    cid_tx *tx;
+    int i, busy, guard = TUNE_GUARD_MS * CID_CANONICAL_RATE / 1000;
+    int max = guard * 2 + TX_MAX_BITS * (CID_CANONICAL_RATE / FSK_BAUD + 1);
+    char date_time[9];
+
+    if (!(tx = malloc(sizeof(*tx))))
+	return -1;
+
+    for (i = 0; i < TUNE_SPILLS; i++) {
+	if (cid_tx_init(tx, 1, CID_CANONICAL_RATE, FSK_BAUD, CID_SIG_V23, 30000) ||
+	    !(sig[i].samples = malloc(max * sizeof(short)))) {
+	    free(tx);
+	    return -1;
+	}
+	snprintf(date_time, sizeof(date_time), "%02d%02d%02d%02d", 1 + i, 1 + 3 * i, 2 * i, 7 * i);
+	sig[i].msg_len = cid_msg_build(sig[i].msg, MDMF, date_time, tune_numbers[i], tune_names[i]);
+	cid_tx_ring(tx, 0, 0, TUNE_GUARD_MS, sig[i].msg, sig[i].msg_len);
+
+	for (sig[i].len = 0, busy = 1; busy && sig[i].len + 256 <= max; sig[i].len += 256)
+	    busy = cid_tx_render(tx, sig[i].samples + sig[i].len, 256);
+	memset(sig[i].samples + sig[i].len, 0, (max - sig[i].len) * sizeof(short));
+	sig[i].len = (sig[i].len + guard < max) ? sig[i].len + guard : max;
+	sig[i].rate = CID_CANONICAL_RATE;
+	sig[i].path = NULL;
+    }
+    free(tx);
+    return 0;
+}
+
+/**@brief Read a corpus file
+ * @param path wav file, 16 bits mono
+ * @param sig signal to fill, its bytes are decoded later by the reference engine
+ * @return 0 if successful else -1 if error
+ */
+static int read_corpus(const char *path, struct tune_signal *sig)
+{
+    FILE *fp;
+    wav_header wh;
+    int nin;
+
+    if (!(fp = fopen(path, "rb")) || fread(&wh, sizeof(wh), 1, fp) != 1 ||
+	strncmp(wh.chunk_id, "RIFF", 4) || wh.bps != 16 || wh.num_channels != 1) {
+	fprintf(stderr, "%s: not a 16 bits mono wav file\n", path);
+	if (fp)
+	    fclose(fp);
+	return -1;
+    }
+
+    nin = wh.datachunk_size / 2;
+    if (!(sig->samples = malloc(nin * sizeof(short))) ||
+	(nin = fread(sig->samples, sizeof(short), nin, fp)) <= 0) {
+	free(sig->samples);
+	fclose(fp);
+	return -1;
+    }
+    fclose(fp);
+
+    sig->len = nin;
+    sig->rate = wh.sample_rate;
+    sig->path = path;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct tune_signal sig[TUNE_SPILLS + 64];
+    unsigned char out[TUNE_MAX_BYTES];
+    const char *path = CID_PROFILE_PATH;
+    cid_profile prof;
+    int nsig = 0, ncorpus = 0;
+    int e, i, k, n, ok;
+    double ns, best_ns;
+
+    for (argv++; *argv; argv++) {
+	if (strcmp(*argv, "-o") == 0 && argv[1])
+	    path = *++argv;
+	else if (strcmp(*argv, "-v") == 0)
+	    verbose = 1;
+	else if (strcmp(*argv, "-h") == 0) {
+	    printf("Usage: ./cid_tune [-o 'PROFILE'] [-v] ['FN' ...]\n");
+	    printf("PROFILE : profile to write, %s by default\n", CID_PROFILE_PATH);
+	    printf("FN : wav files (16 bits, mono) of the accuracy corpus\n");
+	    return 0;
+	} else if (ncorpus < 64 && read_corpus(*argv, &sig[TUNE_SPILLS + ncorpus]) == 0)
+	    ncorpus++;
+    }
+
+    if (make_spills(sig)) {
+	fprintf(stderr, "Unable to modulate the spills\n");
+	return EXIT_FAILURE;
+    }
+    nsig = TUNE_SPILLS;
+
+    /* The corpus files are checked against what the reference engine decodes */
+    for (i = TUNE_SPILLS; i < TUNE_SPILLS + ncorpus; i++) {
+	n = tune_decode(&sig[i], FSK_ENGINE_IIR, PROFILE_PERIOD_SIZE * PROFILE_PERIOD_COUNT,
+			sig[i].msg, TUNE_MAX_BYTES, NULL);
+	if (n < 3 || sig[i].msg[1] + 3 > n) {   // Type, length, parameters and checksum
+	    printf("%s : not decoded by the reference engine, skipped\n", sig[i].path);
+	    continue;
+	}
+	sig[nsig] = sig[i];
+	sig[nsig++].msg_len = sig[i].msg[1] + 3;
+    }
+
+    profile_default(&prof);
+    best_ns = 0;
+
+    for (e = 0; e < FSK_ENGINES; e++)
+	for (k = 0; k < (int) (sizeof(block_sizes) / sizeof(block_sizes[0])); k++) {
+	    if (fsk_engine_lookup(fsk_engine_name(e)) != e)
+		break;                          // Engine number not in use
+	    for (i = 0, ok = 1; i < nsig && ok; i++)
+		ok = (tune_decode(&sig[i], e, block_sizes[k] * PROFILE_PERIOD_COUNT, out,
+				  sig[i].msg_len, NULL) == sig[i].msg_len &&
+		      memcmp(out, sig[i].msg, sig[i].msg_len) == 0);
+	    if (!ok) {
+		i--;                            // Signal which failed
+		if (sig[i].path)
+		    printf("%-8s block %5d : fails on %s\n", fsk_engine_name(e), block_sizes[k], sig[i].path);
+		else
+		    printf("%-8s block %5d : fails on spill %d\n", fsk_engine_name(e), block_sizes[k], i);
+		if (e == FSK_ENGINE_IIR && block_sizes[k] == PROFILE_PERIOD_SIZE) {
+		    fprintf(stderr, "The reference configuration fails, profile not written\n");
+		    return EXIT_FAILURE;
+		}
+		continue;
+	    }
+
+	    /* Timed on the spills only, they are at the internal rate */
+	    ns = tune_time(sig, TUNE_SPILLS, e, block_sizes[k] * PROFILE_PERIOD_COUNT);
+	    printf("%-8s block %5d : %7.1f ns/sample\n", fsk_engine_name(e), block_sizes[k], ns);
+	    if (best_ns == 0 || ns * TUNE_TIE < best_ns ||
+		(ns < best_ns && block_sizes[k] <= prof.period_size)) {
+		best_ns = ns;
+		prof.engine = e;
+		prof.period_size = block_sizes[k];
+	    }
+	}
+    prof.ns_per_sample = best_ns;
+
+    printf("Best: engine %s, period_size %d (%.1f ns/sample, %.0fx real time)\n",
+	   fsk_engine_name(prof.engine), prof.period_size, best_ns, 1e9 / CID_CANONICAL_RATE / best_ns);
+
+    if (profile_save(path, &prof)) {
+	perror(path);
+	return EXIT_FAILURE;
+    }
+    printf("Profile written to %s\n", path);
+    return 0;
+}
@@ -0,0 +1,183 @@
+/**@file cidtx.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Sends CallerID spills on FXS ports
+ *
+ * One thread renders the spills of all the ports into a multichannel
+ * period, one channel per port, and writes it to the sound card with
+ * pcm_write() or pcm_mmap_write(), or to a wav file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fskmodem.h"
+#include "ciddeco.h"
+#include "fsktx.h"
+
+#define TX_TAIL_MS              500     // Silence after the last spill
+
+/**@brief Write the wav file header for the rendered samples */
+static void put_header(FILE * fp, int channels, int rate, unsigned int bytes)
+{
+    wav_header wh;
+
+    memcpy(wh.chunk_id, "RIFF", 4);
+    wh.chunk_size = 36 + bytes;
+    memcpy(wh.format, "WAVE", 4);
+    memcpy(wh.fmtchunk_id, "fmt ", 4);
+    wh.fmtchunk_size = 16;
+    wh.audio_format = 1;
+    wh.num_channels = channels;
+    wh.sample_rate = rate;
+    wh.byte_rate = rate * channels * 2;
+    wh.block_align = channels * 2;
+    wh.bps = 16;
+    memcpy(wh.datachunk_id, "data", 4);
+    wh.datachunk_size = bytes;
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&wh, sizeof(wh), 1, fp);
+}
+
+/**@brief Send CallerID
+ *
+ */
+int main(int argc, char *argv[])
+{
+    int nports = 1;             // No. of FXS ports, one channel each
+    int samp_rate = 44100;      // Default sampling rate
+    int baud_rate = FSK_BAUD;   // Default baud rate
+    int fsk_std = 0;            // 1200/2200 Hz
+    int amp = 30000;            // Peak amplitude
+    int delay_ms = TX_DELAY_MS; // Start of the spill after the ring
+    int gap_ms = 0;             // Ring of port n ends n * gap_ms after port 0
+    int type = MDMF;
+    int use_mmap = 0;
+    unsigned int period_size = 1024;
+    unsigned int card = 1, device = 0;
+    const char *date_time = "06070809";
+    const char *number = "9987654321";
+    const char *name = "John Smith";
+    const char *out_file = NULL;
+
+    cid_tx *tx;
+    unsigned char msg[TX_MAX_MSG];
+    short *period;
+    int len, i, busy, tail;
+    unsigned int bytes = 0, period_bytes;
+    struct pcm_config config;
+    struct pcm *pcm = NULL;
+    FILE *fp = NULL;
+
+    /* parse command line arguments */
+    argv++;
+    while (*argv) {
+	if (strcmp(*argv, "-p") == 0 && argv[1])
+	    nports = atoi(*++argv);
+	else if (strcmp(*argv, "-s") == 0 && argv[1])
+	    samp_rate = atoi(*++argv);
+	else if (strcmp(*argv, "-B") == 0 && argv[1])
+	    baud_rate = atoi(*++argv);
+	else if (strcmp(*argv, "-f") == 0 && argv[1])
+	    fsk_std = atoi(*++argv);
+	else if (strcmp(*argv, "-a") == 0 && argv[1])
+	    amp = atoi(*++argv);
+	else if (strcmp(*argv, "-D") == 0 && argv[1])
+	    delay_ms = atoi(*++argv);
+	else if (strcmp(*argv, "-g") == 0 && argv[1])
+	    gap_ms = atoi(*++argv);
+	else if (strcmp(*argv, "-P") == 0 && argv[1])
+	    period_size = atoi(*++argv);
+	else if (strcmp(*argv, "-c") == 0 && argv[1])
+	    card = atoi(*++argv);
+	else if (strcmp(*argv, "-d") == 0 && argv[1])
+	    device = atoi(*++argv);
+	else if (strcmp(*argv, "-t") == 0 && argv[1])
+	    date_time = *++argv;
+	else if (strcmp(*argv, "-n") == 0 && argv[1])
+	    number = *++argv;
+	else if (strcmp(*argv, "-N") == 0 && argv[1])
+	    name = *++argv;
+	else if (strcmp(*argv, "-o") == 0 && argv[1])
+	    out_file = *++argv;
+	else if (strcmp(*argv, "-S") == 0)
+	    type = SDMF;
+	else if (strcmp(*argv, "-m") == 0)
+	    use_mmap = 1;
+	argv++;
+    }
+
+    if (!(tx = malloc(sizeof(*tx))) ||
+	cid_tx_init(tx, nports, samp_rate, baud_rate, fsk_std, amp)) {
+	fprintf(stderr, "Unable to create transmitter for %d ports\n", nports);
+	exit(EXIT_FAILURE);
+    }
+
+    if ((len = cid_msg_build(msg, type, date_time, strcmp(number, "-") ? number : NULL,
+			     strcmp(name, "-") ? name : NULL)) < 0) {
+	fprintf(stderr, "Invalid CID message\n");
+	exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < nports; i++)        // Rings end now, one port after the other
+	cid_tx_ring(tx, i, (long long) i * gap_ms * samp_rate / 1000, delay_ms, msg, len);
+
+    period_bytes = period_size * nports * sizeof(short);
+    if (!(period = malloc(period_bytes))) {
+	fprintf(stderr, "Unable to allocate %u bytes\n", period_bytes);
+	exit(EXIT_FAILURE);
+    }
+
+    if (out_file) {
+	if (!(fp = fopen(out_file, "wb"))) {
+	    perror("opening output file");
+	    exit(EXIT_FAILURE);
+	}
+	put_header(fp, nports, samp_rate, 0);
+    } else {
+	memset(&config, 0, sizeof(config));
+	config.channels = nports;
+	config.rate = samp_rate;
+	config.period_size = period_size;
+	config.period_count = 4;
+	config.format = PCM_FORMAT_S16_LE;
+
+	pcm = pcm_open(card, device, PCM_OUT | (use_mmap ? PCM_MMAP : 0), &config);
+	if (!pcm || !pcm_is_ready(pcm)) {
+	    fprintf(stderr, "Unable to open PCM device (%s)\n", pcm_get_error(pcm));
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    fprintf(stdout, "Sending %d byte CID message on %d ports\n", len, nports);
+
+    tail = TX_TAIL_MS * samp_rate / 1000;
+    do {
+	busy = cid_tx_render(tx, period, period_size);
+	if (!busy)
+	    tail -= period_size;
+
+	if (fp)
+	    fwrite(period, 1, period_bytes, fp);
+	else if ((use_mmap ? pcm_mmap_write(pcm, period, period_bytes) :
+		  pcm_write(pcm, period, period_bytes))) {
+	    fprintf(stderr, "Error playing sample (%s)\n", pcm_get_error(pcm));
+	    break;
+	}
+	bytes += period_bytes;
+    } while (busy || tail > 0);
+
+    if (fp) {
+	put_header(fp, nports, samp_rate, bytes);
+	fclose(fp);
+    } else
+	pcm_close(pcm);
+
+    fprintf(stdout, "Sent %u bytes\n", bytes);
+    free(period);
+    free(tx);
+    return 0;
+}
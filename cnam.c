@@ -0,0 +1,304 @@
+/**@file cnam.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Caller name cache filled asynchronously from a directory service
+ *
+ * The decoder asks for the name as soon as the number parameter is parsed,
+ * before the checksum. cnam_prefetch() only reserves a slot and queues it,
+ * the directory is asked by a separate thread, so by the time the message
+ * is complete the name is usually in the cache. Numbers the directory does
+ * not know are cached too (negative caching), for a shorter time.
+ *
+ * The directory service listens on a UNIX stream socket. The request is
+ * the number followed by a newline, the answer is the name followed by a
+ * newline, or an empty line if the name is not known.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "cnam.h"
+
+static unsigned int cnam_hash(const char *number)
+{
+    unsigned int h = 2166136261u;               // FNV-1a
+
+    while (*number)
+	h = (h ^ (unsigned char) *number++) * 16777619u;
+    return h & (CNAM_HASH - 1);
+}
+
+/**@brief Find the slot of a number, -1 if not cached. Called with the lock held. */
+static int cnam_find(cnam_cache * c, const char *number)
+{
+    int i;
+
+    for (i = c->bucket[cnam_hash(number)]; i != -1; i = c->slot[i].next) {
+	if (!strcmp(c->slot[i].number, number))
+	    return i;
+    }
+    return -1;
+}
+
+/**@brief Remove a slot from its hash bucket. Called with the lock held. */
+static void cnam_unlink(cnam_cache * c, int s)
+{
+    int *p = &c->bucket[cnam_hash(c->slot[s].number)];
+
+    while (*p != s)
+	p = &c->slot[*p].next;
+    *p = c->slot[s].next;
+    c->slot[s].state = CNAM_EMPTY;
+}
+
+/**@brief Get a free slot with the CLOCK algorithm. Called with the lock held.
+ *
+ * Slots used since the hand last passed get a second chance, slots with a
+ * lookup in progress are never taken.
+ *
+ * @return index of the slot, or -1 if every slot is pending
+ */
+static int cnam_evict(cnam_cache * c)
+{
+    int n, s;
+
+    for (n = 0; n < 2 * CNAM_SLOTS; n++) {
+	s = c->hand;
+	c->hand = (c->hand + 1) % CNAM_SLOTS;
+
+	if (c->slot[s].state == CNAM_EMPTY)
+	    return s;
+	if (c->slot[s].state == CNAM_PENDING)
+	    continue;
+	if (c->slot[s].ref) {
+	    c->slot[s].ref = 0;
+	    continue;
+	}
+	cnam_unlink(c, s);
+	return s;
+    }
+    return -1;
+}
+
+/**@brief Ask the directory service for the name of a number.
+ *
+ * @param c pointer to the cache
+ * @param number the number
+ * @param name buffer of CNAM_LEN bytes for the name
+ *
+ * @retval 1 if the name was found
+ * @retval 0 if the directory has no name for the number
+ * @retval -1 if the directory could not be reached
+ */
+static int cnam_query(cnam_cache * c, const char *number, char *name)
+{
+    struct sockaddr_un addr;
+    struct timeval tv = { CNAM_TIMEOUT_MS / 1000, (CNAM_TIMEOUT_MS % 1000) * 1000 };
+    char buf[CNAM_LEN + 2];
+    int fd, n, i, len = 0, total = 0, eol = 0;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+	return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", c->sock_path) >=
+	(int) sizeof(addr.sun_path)) {
+	close(fd);
+	return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    snprintf(buf, sizeof(buf), "%s\n", number);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+	write(fd, buf, strlen(buf)) != (ssize_t) strlen(buf)) {
+	close(fd);
+	return -1;
+    }
+
+    /* The name is read up to the end of line, cut to CNAM_LEN - 1 bytes,
+       the rest of a longer name is read and dropped */
+    while (!eol && total < CNAM_MAX_REPLY && (n = read(fd, buf, sizeof(buf))) > 0) {
+	for (i = 0; i < n && buf[i] != '\n'; i++)
+	    if (len < CNAM_LEN - 1)
+		name[len++] = buf[i];
+	eol = (i < n);
+	total += n;
+    }
+    close(fd);
+
+    name[len] = '\0';
+    if (!eol)
+	return -1;                              // Timeout, closed early or no end of line
+    return len != 0;
+}
+
+/**@brief Lookup thread: serves the queued slots one after the other */
+static void *cnam_thread(void *ptr)
+{
+    cnam_cache *c = ptr;
+    char number[CNAM_LEN], name[CNAM_LEN];
+    int s, res;
+
+    pthread_mutex_lock(&c->lock);
+    while (!c->stop) {
+	if (c->q_head == c->q_tail) {
+	    pthread_cond_wait(&c->wake, &c->lock);
+	    continue;
+	}
+	s = c->queue[c->q_tail++ % CNAM_QUEUE];
+	memcpy(number, c->slot[s].number, CNAM_LEN);
+	pthread_mutex_unlock(&c->lock);
+
+	res = cnam_query(c, number, name);      // Directory is asked without the lock
+
+	pthread_mutex_lock(&c->lock);
+	if (res < 0) {                          // Not reachable, try again next time
+	    cnam_unlink(c, s);
+	} else {
+	    c->slot[s].state = res ? CNAM_FOUND : CNAM_NEGATIVE;
+	    memcpy(c->slot[s].name, name, CNAM_LEN);
+	    c->slot[s].expires = time(NULL) + (res ? CNAM_TTL : CNAM_NEG_TTL);
+	}
+	pthread_cond_broadcast(&c->done);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+/**@brief Create the cache and start its lookup thread.
+ * @param sock_path UNIX socket of the directory service
+ * @return Returns a pointer to a malloc'd cnam_cache, or NULL on error.
+ */
+cnam_cache *cnam_new(const char *sock_path)
+{
+    cnam_cache *c;
+
+    if (!(c = calloc(1, sizeof(*c))))
+	return NULL;
+
+    memset(c->bucket, -1, sizeof(c->bucket));
+    snprintf(c->sock_path, sizeof(c->sock_path), "%s", sock_path);
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->wake, NULL);
+    pthread_cond_init(&c->done, NULL);
+
+    if (pthread_create(&c->thread, NULL, cnam_thread, c)) {
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->wake);
+	pthread_cond_destroy(&c->done);
+	free(c);
+	return NULL;
+    }
+    return c;
+}
+
+/**@brief Start the lookup of a number without waiting for it.
+ *
+ * Nothing is done if the number is cached and not expired, or already
+ * being looked up. If the queue is full the lookup is skipped.
+ *
+ * @param c pointer to the cache
+ * @param number the number, possibly before the checksum is verified
+ */
+void cnam_prefetch(cnam_cache * c, const char *number)
+{
+    int s;
+
+    if (!number[0] || strlen(number) >= CNAM_LEN)
+	return;
+
+    pthread_mutex_lock(&c->lock);
+    s = cnam_find(c, number);
+    if (s != -1 && (c->slot[s].state == CNAM_PENDING || c->slot[s].expires > time(NULL))) {
+	c->slot[s].ref = 1;
+	pthread_mutex_unlock(&c->lock);
+	return;
+    }
+    if (s != -1)
+	cnam_unlink(c, s);                      // Expired
+
+    if (c->q_head - c->q_tail < CNAM_QUEUE && (s = cnam_evict(c)) != -1) {
+	strcpy(c->slot[s].number, number);
+	c->slot[s].state = CNAM_PENDING;
+	c->slot[s].ref = 1;
+	c->slot[s].next = c->bucket[cnam_hash(number)];
+	c->bucket[cnam_hash(number)] = s;
+
+	c->queue[c->q_head++ % CNAM_QUEUE] = s;
+	pthread_cond_signal(&c->wake);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/**@brief Get the name of a number from the cache.
+ *
+ * @param c pointer to the cache
+ * @param number the number
+ * @param name buffer of CNAM_LEN bytes for the name
+ * @param wait_ms time to wait for a lookup in progress, 0 to not wait
+ *
+ * @retval 1 if the name was found
+ * @retval 0 if the directory has no name for the number
+ * @retval -1 if the number is not in the cache (yet)
+ */
+int cnam_get(cnam_cache * c, const char *number, char *name, int wait_ms)
+{
+    struct timespec ts;
+    int s, res = -1;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += wait_ms / 1000;
+    ts.tv_nsec += (wait_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+	ts.tv_sec++;
+	ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+	s = cnam_find(c, number);
+	if (s == -1 || (c->slot[s].state != CNAM_PENDING && c->slot[s].expires <= time(NULL)))
+	    break;
+	if (c->slot[s].state == CNAM_PENDING) {
+	    if (wait_ms > 0 && pthread_cond_timedwait(&c->done, &c->lock, &ts) != ETIMEDOUT)
+		continue;
+	    break;
+	}
+	c->slot[s].ref = 1;
+	res = (c->slot[s].state == CNAM_FOUND);
+	if (res)
+	    memcpy(name, c->slot[s].name, CNAM_LEN);
+	break;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return res;
+}
+
+/**@brief Stop the lookup thread and free the cache.
+ * @param c pointer to the cache
+ */
+void cnam_free(cnam_cache * c)
+{
+    if (!c)
+	return;
+
+    pthread_mutex_lock(&c->lock);
+    c->stop = 1;
+    pthread_cond_signal(&c->wake);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->thread, NULL);
+
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->wake);
+    pthread_cond_destroy(&c->done);
+    free(c);
+}
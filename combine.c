@@ -0,0 +1,120 @@
+/**@file combine.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Diversity combining of the two captured channels
+ *
+ * Both channels of the card carry the same line through different paths,
+ * so the FSK signal is common to both and the noise is independent. The
+ * cross power of the channels is then an estimate of the signal power S,
+ * and what is left of the power of a channel is its noise N. The channels
+ * are weighted by 1/N (maximal-ratio, same signal gain on both paths) or
+ * the one with the better S/N is selected, before demodulation.
+ */
+#include <string.h>
+
+#include "combine.h"
+
+/**@brief Initialize the combiner.
+ * @param d pointer to the combiner
+ * @param mode COMBINE_OFF, COMBINE_SELECT or COMBINE_MRC
+ */
+void diversity_init(diversity * d, int mode)
+{
+    memset(d, 0, sizeof(*d));
+    d->mode = mode;
+    d->w[0] = 1;                                // Until estimated, first channel only
+}
+
+/**@brief Update the SNR of the two channels from a block of frames.
+ *
+ * The mean of the block is removed first, DC offset of a line is not signal.
+ *
+ * @param d pointer to the combiner
+ * @param frames interleaved samples of the two channels
+ * @param nframes no. of frames
+ */
+static void diversity_estimate(diversity * d, const short *frames, int nframes)
+{
+    double m0 = 0, m1 = 0, p0 = 0, p1 = 0, c = 0;
+    double s, n0, n1, a, b;
+    int i;
+
+    for (i = 0; i < nframes; i++) {
+	m0 += frames[2 * i];
+	m1 += frames[2 * i + 1];
+    }
+    m0 /= nframes;
+    m1 /= nframes;
+
+    for (i = 0; i < nframes; i++) {
+	a = frames[2 * i] - m0;
+	b = frames[2 * i + 1] - m1;
+	p0 += a * a;
+	p1 += b * b;
+	c += a * b;
+    }
+    p0 /= nframes;
+    p1 /= nframes;
+    c /= nframes;
+
+    if (!d->primed) {
+	d->pow[0] = p0;
+	d->pow[1] = p1;
+	d->cross = c;
+	d->primed = 1;
+    } else {
+	d->pow[0] += COMBINE_ALPHA * (p0 - d->pow[0]);
+	d->pow[1] += COMBINE_ALPHA * (p1 - d->pow[1]);
+	d->cross += COMBINE_ALPHA * (c - d->cross);
+    }
+
+    s = (d->cross > 0) ? d->cross : 0;          // Common signal power
+    n0 = d->pow[0] - s;                         // Noise power of every channel
+    n1 = d->pow[1] - s;
+    if (n0 < 1)
+	n0 = 1;
+    if (n1 < 1)
+	n1 = 1;
+
+    d->snr[0] = s / n0;
+    d->snr[1] = s / n1;
+
+    if (d->mode == COMBINE_MRC) {               // Weights normalized so that the
+	d->w[0] = n1 / (n0 + n1);               // signal level stays the same
+	d->w[1] = n0 / (n0 + n1);
+    } else {
+	d->w[0] = (n0 <= n1) ? 1 : 0;
+	d->w[1] = 1 - d->w[0];
+    }
+}
+
+/**@brief Combine interleaved stereo frames into a single channel.
+ *
+ * The output can be the same buffer as the input.
+ *
+ * @param d pointer to the combiner
+ * @param frames interleaved samples of the two channels
+ * @param nframes no. of frames
+ * @param out nframes combined samples
+ *
+ * @return no. of output samples
+ */
+int diversity_combine(diversity * d, const short *frames, int nframes, short *out)
+{
+    int i;
+    double v;
+
+    if (nframes <= 0)
+	return 0;
+
+    if (d->mode != COMBINE_OFF)
+	diversity_estimate(d, frames, nframes);
+
+    for (i = 0; i < nframes; i++) {
+	v = d->w[0] * frames[2 * i] + d->w[1] * frames[2 * i + 1];
+	out[i] = (v > 32767) ? 32767 : ((v < -32768) ? -32768 : (short) v);
+    }
+    return nframes;
+}
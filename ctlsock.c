@@ -0,0 +1,264 @@
+/**@file ctlsock.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Control socket arming the line from the ring controller
+ *
+ * The SLIC driver knows when a ring ends, and on which line. Instead of
+ * SIGINT, which carries neither, it sends a datagram to the Unix socket of
+ * the line:							<BR>
+ *      arm N T							<BR>
+ * N is the line and T the end of the ring in micro seconds since the Epoch
+ * (the time of the call records), the arrival time if left out. The answer
+ * is "armed N" or "error ...", sent back when the controller's socket is
+ * bound. A "%d" in the socket path is replaced by the line, so every
+ * cid_super shard has its own socket.
+ *
+ * The samples are captured all the time into a history of CTL_HISTORY_MS,
+ * and nothing is demodulated until the line is armed. Demodulation then
+ * starts CTL_PREROLL_MS before the end of the ring, from the history, and
+ * stops CTL_ARM_MS after it. The frames lost by an xrun are not in the
+ * history, the gaps are kept beside it to time the samples and to be
+ * concealed when the samples after them are read. A T older than the
+ * history is answered with an error.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "ctlsock.h"
+
+/**@brief Open the control socket of a line.
+ *
+ * @param path socket path, "%d" is replaced by the line
+ * @param line line decoded by this process
+ *
+ * @return Returns a pointer to a malloc'd ctl_sock, or NULL on error.
+ */
+ctl_sock *ctl_open(const char *path, int line)
+{
+    ctl_sock *c;
+    const char *d = strstr(path, "%d");
+    int n;
+
+    if (!(c = calloc(1, sizeof(*c))))
+	return NULL;
+
+    c->line = line;
+    c->addr.sun_family = AF_UNIX;
+    if (d)
+	n = snprintf(c->addr.sun_path, sizeof(c->addr.sun_path), "%.*s%d%s",
+		     (int) (d - path), path, line, d + 2);
+    else
+	n = snprintf(c->addr.sun_path, sizeof(c->addr.sun_path), "%s", path);
+    if (n >= (int) sizeof(c->addr.sun_path) || (c->fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+	free(c);
+	return NULL;
+    }
+
+    unlink(c->addr.sun_path);                   // Left over by a crashed process
+    if (bind(c->fd, (struct sockaddr *) &c->addr, sizeof(c->addr)) < 0 ||
+	fcntl(c->fd, F_SETFL, O_NONBLOCK) < 0) {
+	close(c->fd);
+	free(c);
+	return NULL;
+    }
+    return c;
+}
+
+/**@brief Read the pending commands.
+ *
+ * Never blocks. When several arm commands are pending, the last one wins.
+ *
+ * @param c control socket
+ * @param ring_end_us end of the ring of the last arm command
+ *
+ * @return 1 if the line was armed, else 0
+ */
+int ctl_poll(ctl_sock * c, long long *ring_end_us)
+{
+    char msg[CTL_MSG_LEN], reply[CTL_MSG_LEN];
+    struct sockaddr_un from;
+    socklen_t flen;
+    struct timeval now;
+    long long t;
+    int n, line, armed = 0;
+
+    for (;;) {
+	flen = sizeof(from);
+	if ((n = recvfrom(c->fd, msg, sizeof(msg) - 1, 0, (struct sockaddr *) &from, &flen)) < 0)
+	    break;
+	msg[n] = 0;
+
+	gettimeofday(&now, NULL);
+	t = now.tv_sec * 1000000LL + now.tv_usec;
+	n = sscanf(msg, "arm %d %lld", &line, &t);
+	if (n < 1)
+	    snprintf(reply, sizeof(reply), "error unknown command\n");
+	else if (line != c->line)
+	    snprintf(reply, sizeof(reply), "error line %d is not decoded here\n", line);
+	else if (t < now.tv_sec * 1000000LL + now.tv_usec - (CTL_HISTORY_MS - CTL_PREROLL_MS) * 1000LL)
+	    snprintf(reply, sizeof(reply), "error the ring is older than the history\n");
+	else {
+	    *ring_end_us = t;
+	    armed = 1;
+	    snprintf(reply, sizeof(reply), "armed %d\n", line);
+	}
+
+	if (flen > sizeof(sa_family_t))         // The controller can get an answer
+	    sendto(c->fd, reply, strlen(reply), 0, (struct sockaddr *) &from, flen);
+    }
+    return armed;
+}
+
+/**@brief Close and remove the control socket.
+ *
+ * @param c control socket
+ */
+void ctl_close(ctl_sock * c)
+{
+    if (c) {
+	close(c->fd);
+	unlink(c->addr.sun_path);
+	free(c);
+    }
+}
+
+/**@brief Initialize the history of the captured samples.
+ *
+ * @param h history
+ * @param s ring of samples
+ * @param len no. of samples in the ring
+ * @param rate sampling rate
+ */
+void ctl_history_init(ctl_history * h, short *s, int len, int rate)
+{
+    h->s = s;
+    h->len = len;
+    h->rate = rate;
+    h->count = 0;
+    h->end_us = 0;
+    h->ngaps = 0;
+}
+
+/**@brief Record frames lost before the next samples of the history.
+ *
+ * @param h history
+ * @param frames no. of frames lost
+ */
+void ctl_history_gap(ctl_history * h, unsigned int frames)
+{
+    struct ctl_gap *g;
+
+    if (h->ngaps && (g = &h->gap[(h->ngaps - 1) % CTL_MAX_GAPS])->pos == h->count) {
+	g->frames += frames;                    // No sample since the last one
+	return;
+    }
+    g = &h->gap[h->ngaps++ % CTL_MAX_GAPS];
+    g->pos = h->count;
+    g->frames = frames;
+}
+
+/**@brief Append captured samples to the history.
+ *
+ * @param h history
+ * @param s samples
+ * @param n no. of samples
+ * @param end_us time of the last sample
+ */
+void ctl_history_put(ctl_history * h, const short *s, int n, long long end_us)
+{
+    int i, pos;
+
+    for (i = 0; i < n; i++) {
+	pos = (h->count + i) % h->len;
+	h->s[pos] = s[i];
+    }
+    h->count += n;
+    h->end_us = end_us;
+}
+
+/**@brief Position in the history of a time.
+ *
+ * The time of a sample follows from the time of the last one, going back
+ * over the samples and over the frames of the gaps in between. A time in a
+ * gap is the first sample after it.
+ *
+ * @param h history
+ * @param t_us time
+ *
+ * @return sample no., clamped to the samples in the history, or -1 if the
+ * time is older than the history can hold
+ */
+long long ctl_history_at(const ctl_history * h, long long t_us)
+{
+    long long pos = h->count;
+    long long oldest = (h->count > h->len) ? h->count - h->len : 0;
+    long long span = h->len, back = 0;
+    const struct ctl_gap *g;
+    int i;
+
+    for (i = h->ngaps - 1; i >= 0 && i >= h->ngaps - CTL_MAX_GAPS; i--)
+	if (h->gap[i % CTL_MAX_GAPS].pos > oldest)
+	    span += h->gap[i % CTL_MAX_GAPS].frames;    // Time covered by the history
+    if (t_us < h->end_us - span * 1000000 / h->rate)
+	return -1;
+    if (t_us < h->end_us)                       // Frames back from the end, a later time is the end
+	back = (h->end_us - t_us) * h->rate / 1000000;
+
+    for (i = h->ngaps - 1; i >= 0 && i >= h->ngaps - CTL_MAX_GAPS && back > 0; i--) {
+	g = &h->gap[i % CTL_MAX_GAPS];
+	if (pos - back >= g->pos)               // After the gap
+	    break;
+	back -= pos - g->pos;
+	pos = g->pos;
+	back = (back > g->frames) ? back - g->frames : 0;
+    }
+    pos -= back;
+    return (pos < oldest) ? oldest : ((pos > h->count) ? h->count : pos);
+}
+
+/**@brief Read samples from the history.
+ *
+ * The samples read stop at the next gap, the frames lost before them (in
+ * a gap, or overwritten in the history) are returned in gap.
+ *
+ * @param h history
+ * @param pos sample no. to read from, advanced past the samples read
+ * @param out samples read
+ * @param max no. of samples to read at most
+ * @param gap set to the no. of frames lost before the samples read
+ *
+ * @return no. of samples read
+ */
+int ctl_history_get(const ctl_history * h, long long *pos, short *out, int max, unsigned int *gap)
+{
+    const struct ctl_gap *g;
+    long long skip = 0;
+    int i, n;
+
+    if (*pos < h->count - h->len) {             // Overwritten, skip them
+	skip = h->count - h->len - *pos;
+	*pos = h->count - h->len;
+    }
+    n = (h->count - *pos < max) ? h->count - *pos : max;
+    *gap = 0;
+    for (i = (h->ngaps > CTL_MAX_GAPS) ? h->ngaps - CTL_MAX_GAPS : 0; i < h->ngaps; i++) {
+	g = &h->gap[i % CTL_MAX_GAPS];
+	if (g->pos == *pos && n)
+	    *gap = g->frames;
+	else if (g->pos > *pos && g->pos - *pos < n)
+	    n = g->pos - *pos;
+    }
+    if (n)
+	*gap += skip;
+    for (i = 0; i < n; i++)
+	out[i] = h->s[(*pos + i) % h->len];
+    *pos += n;
+    return n;
+}
@@ -0,0 +1,85 @@
+/**@file fft.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Radix-2 FFT
+ *
+ * Iterative decimation in time FFT, in place, for a power of 2 no. of
+ * points. The twiddle factors are computed once by the caller and shared by
+ * all the transforms of that size, so a transform neither allocates nor
+ * calls sin() and cos().
+ *
+ * Only complex transforms are done. The filters of the demodulator are
+ * real, so two real signals are transformed together, one in the real and
+ * one in the imaginary part (see the FSK_ENGINE_FFT engine in fskmodem.c).
+ */
+#include <math.h>
+
+#include "fft.h"
+
+/**@brief Twiddle factors of an FFT of n points.
+ *
+ * @param tw n / 2 twiddle factors, exp(-2 pi i k / n)
+ * @param n no. of points, a power of 2
+ *
+ * @return 0 if successful else -1 if n is not a power of 2
+ */
+int fft_twiddles(fft_cpx * tw, int n)
+{
+    int k;
+
+    if (n < 2 || (n & (n - 1)))
+	return -1;
+    for (k = 0; k < n / 2; k++) {
+	tw[k].re = cos(2 * M_PI * k / n);
+	tw[k].im = -sin(2 * M_PI * k / n);
+    }
+    return 0;
+}
+
+/**@brief In place FFT of n points.
+ *
+ * The inverse transform is not divided by n, the caller scales the
+ * spectrum it multiplies with instead.
+ *
+ * @param x n values, replaced by their transform
+ * @param tw twiddle factors from fft_twiddles()
+ * @param n no. of points, a power of 2
+ * @param inverse 1 for the inverse transform, 0 for the forward one
+ */
+void fft(fft_cpx * x, const fft_cpx * tw, int n, int inverse)
+{
+    int i, j, k, len, half, step;
+    fft_cpx t, w, *a, *b;
+
+    for (i = 1, j = 0; i < n; i++) {            // Bit reversed order
+	for (k = n >> 1; j & k; k >>= 1)
+	    j ^= k;
+	j ^= k;
+	if (i < j) {
+	    t = x[i];
+	    x[i] = x[j];
+	    x[j] = t;
+	}
+    }
+
+    for (len = 2; len <= n; len <<= 1) {        // Butterflies
+	half = len >> 1;
+	step = n / len;
+	for (i = 0; i < n; i += len)
+	    for (k = 0; k < half; k++) {
+		w = tw[k * step];
+		if (inverse)
+		    w.im = -w.im;
+		a = &x[i + k];
+		b = &x[i + k + half];
+		t.re = b->re * w.re - b->im * w.im;
+		t.im = b->re * w.im + b->im * w.re;
+		b->re = a->re - t.re;
+		b->im = a->im - t.im;
+		a->re += t.re;
+		a->im += t.im;
+	    }
+    }
+}
@@ -0,0 +1,279 @@
+/**@file fskbatch.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Batch bit slicer for many lines
+ *
+ * Runs the bit timing recovery of get_bit_raw() for up to FSK_BATCH_LANES
+ * lines in lockstep. Transition check, DPLL adjustment and the end of bit
+ * test are done with masks instead of branches, so every lane executes the
+ * same instructions and the loops can be vectorized. The sliced bits are
+ * packed in a 64 bit word per line, and fsk_batch_get_byte() frames the
+ * bytes on the word with a few shifts and masks.
+ *
+ * Most lines are idle most of the time. One pass over the interleaved
+ * frames sums the level of every line, the lines under the gate that are
+ * not in a message are left out of the bitmap b->active and cost that one
+ * add per sample: no demodulation, no bit queued, and their DPLL is frozen.
+ * A chunk where no line is active is not sliced at all; otherwise all the
+ * lanes run the DPLL instructions in lockstep, masked for the idle ones.
+ *
+ * cid_fsk decodes one line per process through fsk_serial(), so only
+ * cid_bench -l runs the batch slicer for now. It is there for a front end
+ * capturing many lines in one stream.
+ *	
+ * @note Includes code and algorithms from the Zapata library and Aesterisk.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "fskbatch.h"
+
+/**@brief Initialize the batch slicer.
+ *
+ * Copies the DPLL of every line into its lane, as fsk_line_init() set it,
+ * so the lanes and get_bit_raw() count the same bit. The filters stay in
+ * the fsk_data of the line. The unused lanes are never active, their DPLL
+ * stays at 0.
+ *
+ * @param b pointer to the batch slicer
+ * @param lines array of nlines pointers to the FSK data of every line
+ * @param nlines no. of lines
+ *
+ * @return 0 if successful else -1 if error
+ */
+int fsk_batch_init(fsk_batch * b, fsk_data ** lines, int nlines)
+{
+    int l;
+
+    if (nlines < 1 || nlines > FSK_BATCH_LANES)
+	return -1;
+
+    memset(b, 0, sizeof(*b));
+    b->nlines = nlines;
+    b->gate = FSK_BATCH_GATE;
+
+    for (l = 0; l < nlines; l++) {
+	b->fskd[l] = lines[l];
+	b->xi0[l] = lines[l]->xi0;
+	b->icont[l] = lines[l]->icont;
+	b->pllispb[l] = lines[l]->pllispb;
+	b->pllids[l] = lines[l]->pllids;
+	b->pllispb2[l] = lines[l]->pllispb2;
+    }
+    return 0;
+}
+
+/**@brief Advance the DPLL of every lane by one sample.
+ *
+ * Same decisions as get_bit_raw(), written with masks:			<BR>
+ * - a transition is a change of sign of the demodulated value,		<BR>
+ * - on the first transition of a bit the counter is moved towards the
+ *   center of the PLL,                                                 <BR>
+ * - the bit ends when the counter exceeds pllispb.			<BR>
+ * The lanes not live keep their state.
+ *
+ * @param b pointer to the batch slicer
+ * @param live all 1s for the lanes to advance, 0 for the others
+ */
+static void fsk_batch_step(fsk_batch * b, const int *live)
+{
+    int l;
+
+    for (l = 0; l < FSK_BATCH_LANES; l++) {
+	int trans = -((b->ix[l] < 0) ^ (b->xi0[l] < 0));       // All 1s on a transition
+	int adj = trans & ~b->adjusted[l] & live[l];            // Adjust just once per bit
+	int up = -(b->icont[l] < b->pllispb2[l]);               // Increase or decrease
+	int step = (b->pllids[l] & up) - (b->pllids[l] & ~up);
+
+	b->icont[l] += ((step & adj) + 32) & live[l];
+	b->adjusted[l] |= adj;
+	b->xi0[l] = (b->ix[l] & live[l]) | (b->xi0[l] & ~live[l]);
+
+	b->wrap[l] = -(b->icont[l] > b->pllispb[l]);            // End of the bit
+	b->icont[l] -= b->pllispb[l] & b->wrap[l];
+	b->adjusted[l] &= ~b->wrap[l];
+    }
+}
+
+/**@brief Bitmap of the lines to demodulate in a chunk.
+ *
+ * The levels of all the lines are summed in one pass over the frames, the
+ * inner loop runs over the lines of a frame and is vectorized. A line is
+ * active if its mean level reaches the gate, or while it is in a message:
+ * for FSK_BATCH_HOLD chunks after fsk_batch_get_byte() framed a byte, so a
+ * quiet stretch never cuts a message.
+ *
+ * @param b pointer to the batch slicer
+ * @param frames interleaved samples of all the lines
+ * @param chunk no. of frames
+ *
+ * @return bit l set if line l is active
+ */
+static unsigned int fsk_batch_activity(fsk_batch * b, const short *frames, int chunk)
+{
+    int level[FSK_BATCH_LANES] = { 0 };
+    unsigned int active = 0;
+    int n, l;
+
+    for (n = 0; n < chunk; n++, frames += b->nlines)
+	for (l = 0; l < b->nlines; l++)
+	    level[l] += abs(frames[l]);
+
+    for (l = 0; l < b->nlines; l++) {
+	if (level[l] >= b->gate * chunk || b->hold[l] > 0)
+	    active |= 1U << l;
+	else
+	    b->idle[l]++;
+	if (b->hold[l] > 0)
+	    b->hold[l]--;
+    }
+    return active;
+}
+
+/**@brief Slice interleaved frames of all the lines.
+ *
+ * Every frame carries one sample per line, in the order the lines were
+ * given to fsk_batch_init(). The samples of the active lines are
+ * demodulated line by line, up to FSK_BATCH_CHUNK frames at a time so that
+ * the FFT engine sees whole blocks, and then all the lanes are sliced
+ * together. A bit is queued in every active lane whose bit ended, the store
+ * is masked by the end of bit and the head moves by it, so that this loop
+ * has no branch per lane either and a full queue only loses a bit when one
+ * ends. The idle lanes keep their DPLL, and queue no bit.
+ *
+ * A line with no sample above the gate for half a bit reads Mark, the idle
+ * state of a line: the demodulator gives 0, a Space, in the silence after
+ * a spill, where the DPLL may sample the stop bits of the last byte.
+ *
+ * @param b pointer to the batch slicer
+ * @param frames interleaved samples of all the lines
+ * @param nframes no. of frames in the buffer
+ *
+ * @return no. of bits queued on all the lines
+ */
+int fsk_batch_feed(fsk_batch * b, const short *frames, int nframes)
+{
+    short in[FSK_BATCH_CHUNK];
+    int live[FSK_BATCH_LANES] = { 0 };          // The unused lanes are never live
+    int n, l, off, chunk, quiet;
+    int nbits = 0;
+
+    for (off = 0; off < nframes; off += chunk, frames += chunk * b->nlines) {
+	chunk = (nframes - off < FSK_BATCH_CHUNK) ? nframes - off : FSK_BATCH_CHUNK;
+	b->active = fsk_batch_activity(b, frames, chunk);
+	for (l = 0; l < b->nlines; l++) {
+	    live[l] = -((b->active >> l) & 1);          // All 1s if active
+	    if (!live[l])
+		continue;
+	    for (n = 0; n < chunk; n++)
+		in[n] = frames[n * b->nlines + l];
+	    fsk_demod_block(b->fskd[l], in, b->dem[l], chunk);
+
+	    for (n = 0, quiet = b->quiet[l]; n < chunk; n++) {  // End of input is Mark
+		quiet = (abs(in[n]) > b->gate) ? 0 : quiet + 1;
+		if (quiet > b->fskd[l]->ispb / 2)
+		    b->dem[l][n] = -1;
+	    }
+	    b->quiet[l] = quiet;
+	}
+	if (!b->active)                                 // Nothing to slice
+	    continue;
+
+	for (n = 0; n < chunk; n++) {
+	    for (l = 0; l < b->nlines; l++)
+		b->ix[l] = b->dem[l][n];
+
+	    fsk_batch_step(b, live);
+
+	    for (l = 0; l < b->nlines; l++) {
+		struct fsk_bitq *q = &b->q[l];
+		int end = b->wrap[l] & live[l] & 1;
+		uint64_t at = (uint64_t) end << (q->head & (FSK_BITQ_SIZE - 1));
+
+		q->word = (q->word & ~at) | (at & -(uint64_t) (b->ix[l] < 0));
+		q->head += end;
+		nbits += end;
+	    }
+	}
+    }
+
+    for (l = 0; l < b->nlines; l++) {                   // Framer was too late, drop
+	struct fsk_bitq *q = &b->q[l];                  // the oldest bits of the line
+
+	if (q->head - q->tail > FSK_BITQ_SIZE) {
+	    q->overrun += q->head - q->tail - FSK_BITQ_SIZE;
+	    q->tail = q->head - FSK_BITQ_SIZE;
+	}
+    }
+    return nbits;
+}
+
+/**@brief Get the next sliced bit of a line.
+ *
+ * @param b pointer to the batch slicer
+ * @param line index of the line
+ *
+ * @retval 0x80 if the FSK bit is 1 
+ * @retval 0x00 if the FSK bit is 0.
+ * @retval -1 if no bit is queued for the line
+ */
+int fsk_batch_get_bit(fsk_batch * b, int line)
+{
+    struct fsk_bitq *q = &b->q[line];
+
+    if (q->head == q->tail)
+	return -1;
+    return ((q->word >> (q->tail++ & (FSK_BITQ_SIZE - 1))) & 1) ? 0x80 : 0;
+}
+
+/**@brief Get the next framed byte of a line.
+ *
+ * Same framing as get_data_frame(), on the whole queue at once: the queued
+ * bits are rotated into a word starting at the tail, the start bit is the
+ * first Space (count trailing zeros of the inverted word), and the data
+ * and stop bits are taken with a shift and a mask. The Marks before the
+ * start bit are the idle line and are dropped.
+ *
+ * @param b pointer to the batch slicer
+ * @param line index of the line
+ *
+ * A byte framed keeps the line active for FSK_BATCH_HOLD chunks, see
+ * fsk_batch_activity(). Like the rest of the batch slicer it is only
+ * called by cid_bench -l, cid_fsk frames its bytes in get_data_frame().
+ *
+ * @return the byte, -1 if the byte is not all queued yet, or -2 if its stop
+ * bits are missing (the start bit is dropped, the next call looks for
+ * another)
+ */
+int fsk_batch_get_byte(fsk_batch * b, int line)
+{
+    struct fsk_bitq *q = &b->q[line];
+    const fsk_data *fskd = b->fskd[line];
+    unsigned int avail = q->head - q->tail, t = q->tail & (FSK_BITQ_SIZE - 1);
+    unsigned int frame_bits = 1 + fskd->nbit + fskd->instop;
+    uint64_t w = t ? (q->word >> t) | (q->word << (FSK_BITQ_SIZE - t)) : q->word;
+    uint64_t valid = (avail < FSK_BITQ_SIZE) ? (1ULL << avail) - 1 : ~0ULL;
+    uint64_t stop = (1ULL << fskd->instop) - 1;
+    unsigned int start;
+
+    if (!(~w & valid)) {                                // Idle, all Marks
+	q->tail = q->head;
+	return -1;
+    }
+    start = __builtin_ctzll(~w & valid);
+    q->tail += start;
+    if (avail - start < frame_bits)
+	return -1;
+
+    w >>= start;
+    if (((w >> (1 + fskd->nbit)) & stop) != stop) {
+	q->tail++;
+	q->framing++;
+	return -2;
+    }
+    q->tail += frame_bits;
+    b->hold[line] = FSK_BATCH_HOLD;
+    return (w >> 1) & ((1U << fskd->nbit) - 1);
+}
@@ -0,0 +1,220 @@
+/**@file fsktx.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief FSK Modulation of CallerID spills for many ports
+ *
+ * Mirror of fskmodem.c for FXS ports. A spill is the channel seizure, the
+ * Mark signal and the message bytes (start bit, 8 data bits LSB first and
+ * stop bits). Every port has a phase-continuous NCO: a 32 bit phase
+ * accumulator indexing a sine table, with one increment for Mark and one
+ * for Space. The bit clock is a second accumulator, so the bits stay
+ * aligned to the baud rate even when rate/baud is not an integer.
+ */
+#include <string.h>
+#include <math.h>
+
+#include "fskmodem.h"
+#include "ciddeco.h"
+#include "fsktx.h"
+
+static short sine[TX_SINE_SIZE];        // One period of the sine wave
+static int sine_ready = 0;
+
+/**@brief Phase increment of a frequency at the given rate */
+static uint32_t tx_inc(int freq, int rate)
+{
+    return (uint32_t) (((uint64_t) freq << 32) / rate);
+}
+
+/**@brief Initialize the transmitter.
+ *
+ * Frequencies follow fskmodem_init(): 1200/2200 Hz for fsk_std 0, else
+ * 1300/2100 Hz.
+ *
+ * @param tx pointer to the transmitter
+ * @param nports no. of ports (channels of the output)
+ * @param rate sampling rate of the output
+ * @param baud baud rate
+ * @param fsk_std FSK standard
+ * @param amp peak amplitude of the sine wave (max 32767)
+ *
+ * @return 0 if successful else -1 if error
+ */
+int cid_tx_init(cid_tx * tx, int nports, int rate, int baud, int fsk_std, int amp)
+{
+    int i;
+    int mark = fsk_std ? 1300 : 1200;
+    int space = fsk_std ? 2100 : 2200;
+
+    if (nports < 1 || nports > TX_MAX_PORTS || rate <= 0 || baud <= 0)
+	return -1;
+
+    if (!sine_ready) {
+	for (i = 0; i < TX_SINE_SIZE; i++)
+	    sine[i] = (short) lrint(32767 * sin(2 * M_PI * i / TX_SINE_SIZE));
+	sine_ready = 1;
+    }
+
+    memset(tx, 0, sizeof(*tx));
+    tx->rate = rate;
+    tx->baud = baud;
+    tx->fsk_std = fsk_std;
+    tx->nports = nports;
+
+    for (i = 0; i < nports; i++) {
+	tx->port[i].inc[0] = tx_inc(space, rate);
+	tx->port[i].inc[1] = tx_inc(mark, rate);
+	tx->port[i].bit_step = tx_inc(baud, rate);
+	tx->port[i].amp = amp;
+    }
+    return 0;
+}
+
+/**@brief Append a parameter to a MDMF message */
+static int msg_param(unsigned char *msg, int off, int type, const char *val)
+{
+    int len = strlen(val);
+
+    msg[off++] = type;
+    msg[off++] = len;
+    memcpy(msg + off, val, len);
+    return off + len;
+}
+
+/**@brief Build a CID message with its checksum.
+ *
+ * MDMF carries Date & time, Number (or No Number) and Name (or No Name) as
+ * parameters. SDMF carries only date & time followed by the number.
+ *
+ * @param msg buffer of at least TX_MAX_MSG bytes
+ * @param type MDMF or SDMF
+ * @param date_time 8 digits, MMDDHHMM
+ * @param number phone number, or NULL if not present
+ * @param name caller name, or NULL if not present
+ *
+ * @return no. of bytes in the message, or -1 if it does not fit
+ */
+int cid_msg_build(unsigned char *msg, int type, const char *date_time,
+		  const char *number, const char *name)
+{
+    int off = 2;
+    int i, sum = 0;
+
+    if (strlen(date_time) != 8 || (number && strlen(number) > 20) ||
+	(name && strlen(name) > 20))
+	return -1;
+
+    msg[0] = type;
+    if (type == SDMF) {
+	memcpy(msg + off, date_time, 8);
+	off += 8;
+	if (number) {
+	    memcpy(msg + off, number, strlen(number));
+	    off += strlen(number);
+	}
+    } else {
+	off = msg_param(msg, off, DATE_TIME, date_time);
+	off = number ? msg_param(msg, off, NUM, number) : msg_param(msg, off, NO_NUM, "O");
+	off = name ? msg_param(msg, off, NAME, name) : msg_param(msg, off, NO_NAME, "O");
+    }
+    msg[1] = off - 2;
+
+    for (i = 0; i < off; i++)                   // Checksum makes the modulo-256
+	sum += msg[i];                          // sum of the message zero
+    msg[off++] = (256 - (sum & 0xff)) & 0xff;
+    return off;
+}
+
+/**@brief Schedule a spill on a port relative to the end of the ring.
+ *
+ * The bits of the whole spill are prepared here, rendering only looks them up.
+ *
+ * @param tx pointer to the transmitter
+ * @param port index of the port
+ * @param ring_end sample time at which the ring ended
+ * @param delay_ms delay of the spill after the ring
+ * @param msg message bytes, including the checksum
+ * @param len no. of bytes in the message
+ *
+ * @return 0 if successful else -1 if error
+ */
+int cid_tx_ring(cid_tx * tx, int port, long long ring_end, int delay_ms,
+		const unsigned char *msg, int len)
+{
+    struct cid_tx_port *p;
+    int i, j, n = 0;
+
+    if (port < 0 || port >= tx->nports || len <= 0 || len > TX_MAX_MSG)
+	return -1;
+    p = &tx->port[port];
+
+    for (i = 0; i < TX_SEIZURE_BITS; i++)       // Channel seizure, starts with a Space
+	p->bits[n++] = i & 1;
+    for (i = 0; i < TX_MARK_BITS; i++)          // Mark signal
+	p->bits[n++] = 1;
+    for (i = 0; i < len; i++) {
+	p->bits[n++] = 0;                       // Start bit
+	for (j = 0; j < 8; j++)                 // Data bits, LSB first
+	    p->bits[n++] = (msg[i] >> j) & 1;
+	for (j = 0; j < TX_STOP_BITS; j++)      // Stop bits
+	    p->bits[n++] = 1;
+    }
+
+    p->nbits = n;
+    p->bit = 0;
+    p->bit_clock = 0;
+    p->phase = 0;
+    p->start = ring_end + (long long) delay_ms * tx->rate / 1000;
+    p->state = TX_WAIT;
+    return 0;
+}
+
+/**@brief Render the next frames of all the ports.
+ *
+ * Every port writes its own channel of the interleaved frames. A spill
+ * starts exactly at its start sample, even in the middle of a period.
+ *
+ * @param tx pointer to the transmitter
+ * @param frames buffer of nframes * nports samples
+ * @param nframes no. of frames to render
+ *
+ * @return no. of ports still sending or waiting
+ */
+int cid_tx_render(cid_tx * tx, short *frames, int nframes)
+{
+    int i, n, skip, busy = 0;
+    short *out;
+    struct cid_tx_port *p;
+
+    for (i = 0; i < tx->nports; i++) {
+	p = &tx->port[i];
+	out = frames + i;
+	n = 0;
+
+	if (p->state == TX_WAIT) {
+	    skip = (p->start > tx->now) ? p->start - tx->now : 0;
+	    if (skip < nframes)
+		p->state = TX_SEND;
+	    for (; n < nframes && n < skip; n++, out += tx->nports)
+		*out = 0;
+	}
+
+	for (; n < nframes && p->state == TX_SEND; n++, out += tx->nports) {
+	    *out = (sine[p->phase >> (32 - TX_SINE_BITS)] * p->amp) >> 15;
+	    p->phase += p->inc[p->bits[p->bit]];
+
+	    p->bit_clock += p->bit_step;
+	    if (p->bit_clock < p->bit_step && ++p->bit == p->nbits)
+		p->state = TX_IDLE;             // Bit clock wrapped, next bit
+	}
+
+	for (; n < nframes; n++, out += tx->nports)
+	    *out = 0;
+
+	busy += (p->state != TX_IDLE);
+    }
+    tx->now += nframes;
+    return busy;
+}
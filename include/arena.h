@@ -0,0 +1,70 @@
+/**@file arena.h
+ *
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Arena holding the buffers of all the lines in one huge page mapping
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "fskmodem.h"
+#include "ciddeco.h"
+
+#define ARENA_ALIGN             64                      ///< Cache line, every region starts on one
+#define ARENA_HUGE_PAGE         (2 * 1024 * 1024)       ///< Size of a huge page
+#define ARENA_MAX_LINES         4096                    ///< Max. no. of lines in an arena
+
+/// Buffers of one line, carved out of the arena
+typedef struct {
+	struct callerid_state *cs;      ///< Decoder state, hot on every sample
+	cid_data *data;                 ///< Decoded message
+	short *ring;                    ///< Samples captured for the line
+	short *rs;                      ///< Samples resampled to CID_CANONICAL_RATE
+	short *work;                    ///< Scratch of the demodulator, see callerid_feed()
+	short *hist;                    ///< History of the captured samples, see ctlsock.c
+} line_slot;
+
+/** @brief Arena of nlines lines.
+ *
+ * Every line has the same layout, a stride of bytes starting on a cache
+ * line, so that the buffers of line n are at base + n * stride.
+ */
+typedef struct {
+	unsigned char *base;            ///< Start of the mapping
+	size_t size;                    ///< Bytes mapped, a multiple of ARENA_HUGE_PAGE
+	size_t stride;                  ///< Bytes of one line
+	size_t off_data;                ///< Offset of cid_data in a line
+	size_t off_ring;                ///< Offset of the captured samples in a line
+	size_t off_rs;                  ///< Offset of the resampled samples in a line
+	size_t off_work;                ///< Offset of the demodulator scratch in a line
+	size_t off_hist;                ///< Offset of the history in a line
+	int nlines;                     ///< Lines in the arena
+	int ring_len;                   ///< Captured samples per line
+	int rs_len;                     ///< Resampled samples per line
+	int work_len;                   ///< Scratch samples per line
+	int hist_len;                   ///< History samples per line
+	int huge;                       ///< 1 if backed by reserved huge pages (MAP_HUGETLB)
+} line_arena;
+
+/**@brief Map an arena for nlines lines.
+ */
+line_arena *line_arena_new(int nlines, int ring_len, int rs_len, int work_len, int hist_len);
+
+/**@brief Get the buffers of a line.
+ */
+int line_arena_slot(line_arena *a, int line, line_slot *slot);
+
+/**@brief Print the layout and the footprint of the arena.
+ */
+void line_arena_report(const line_arena *a, FILE *fp);
+
+/**@brief Unmap the arena.
+ */
+void line_arena_free(line_arena *a);
+
+#endif
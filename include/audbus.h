@@ -0,0 +1,93 @@
+/**@file audbus.h
+ *
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Shared memory bus publishing the captured periods to other processes
+ */
+
+#ifndef AUDBUS_H
+#define AUDBUS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define AUDBUS_MAGIC            0x53554241U     ///< "ABUS", starts a bus
+#define AUDBUS_VERSION          1       ///< Version of the layout
+#define AUDBUS_SLOTS            32      ///< Periods kept on the bus, how far a reader can fall behind
+#define AUDBUS_ALIGN            4096    ///< Alignment of the periods, a page
+#define AUDBUS_NAME_LEN         64      ///< Max. length of a bus name
+#define AUDBUS_WAIT_MS          100     ///< Longest wait of a reader before it checks the writer
+
+/// Period of a slot
+struct audbus_slot {
+	uint64_t seq;                   ///< No. of the period + 1, 0 while it is written
+	int64_t t_ns;                   ///< Timestamp of the period, CLOCK_MONOTONIC
+	uint32_t frames;                ///< Frames of the period
+	uint32_t lost;                  ///< Frames lost by an xrun before the period
+};
+
+/// Header of a bus, followed by the AUDBUS_SLOTS periods
+struct audbus_header {
+	uint32_t magic;                 ///< AUDBUS_MAGIC
+	uint32_t version;               ///< AUDBUS_VERSION
+	int32_t rate;                   ///< Sampling rate
+	int32_t channels;               ///< Channels of a frame
+	int32_t bits;                   ///< Bits of a sample
+	uint32_t period_bytes;          ///< Bytes of a period
+	uint64_t data_off;              ///< Offset of the first period
+	uint64_t head;                  ///< No. of periods published
+	uint32_t wake;                  ///< Low bits of head, futex of the readers
+	uint32_t refs;                  ///< Processes attached, the writer included
+	uint32_t closed;                ///< 1 once the writer left
+	uint32_t reserved;
+	struct audbus_slot slot[AUDBUS_SLOTS];  ///< Periods, slot n % AUDBUS_SLOTS holds period n
+};
+
+/// Bus mapped by the writer or by a reader
+typedef struct {
+	char name[AUDBUS_NAME_LEN];     ///< Name of the shared memory object
+	struct audbus_header *hdr;      ///< Header, in the mapping
+	unsigned char *data;            ///< First period, in the mapping
+	size_t size;                    ///< Bytes mapped
+	int writer;                     ///< 1 for the writer
+	uint64_t next;                  ///< Writer: period claimed, reader: next period to read
+	uint64_t overruns;              ///< Reader: periods overwritten before they were read
+} audbus;
+
+/**@brief Create a bus and publish its name.
+ */
+audbus *audbus_create(const char *name, int rate, int channels, int bits, uint32_t period_bytes,
+		      int replace);
+
+/**@brief Buffer of the next period, to capture into.
+ */
+void *audbus_claim(audbus *b);
+
+/**@brief Publish the period claimed.
+ */
+void audbus_publish(audbus *b, uint32_t frames, int64_t t_ns, uint32_t lost);
+
+/**@brief Attach to a bus as a reader.
+ */
+audbus *audbus_attach(const char *name);
+
+/**@brief Wait for the next period.
+ */
+const void *audbus_next(audbus *b, const struct audbus_slot **slot);
+
+/**@brief Release the period read.
+ */
+int audbus_done(audbus *b);
+
+/**@brief Print the state of the bus.
+ */
+void audbus_report(const audbus *b, FILE *fp);
+
+/**@brief Leave the bus, the writer closes it.
+ */
+void audbus_close(audbus *b);
+
+#endif
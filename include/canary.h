@@ -0,0 +1,73 @@
+/**@file canary.h
+ *
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Synthetic canary spills measuring the latency of the decoder
+ */
+
+#ifndef CANARY_H
+#define CANARY_H
+
+#include <stdio.h>
+#include "fsktx.h"
+
+#define CANARY_LINE             0xffff  ///< Virtual line of the canaries, tags their call records
+#define CANARY_NAME             "CANARY"        ///< Name sent in every canary, tags the message
+#define CANARY_PREFIX           "000"   ///< Numbers of the canaries, followed by the sequence no.
+#define CANARY_AMP              30000   ///< Peak amplitude of the canary spills
+#define CANARY_TAIL_MS          200     ///< Silence after a spill, for the decoder to finish
+#define CANARY_TIMEOUT_MS       5000    ///< A canary not delivered this long after its spill is lost
+#define CANARY_BUDGET_MS        1500    ///< Default latency budget, injection to delivery
+#define CANARY_BUCKETS          16      ///< Latency buckets, bucket n is below 2^n ms
+
+#define CANARY_IDLE             0       ///< Waiting for the next canary
+#define CANARY_SEND             1       ///< Spill being injected
+#define CANARY_WAIT             2       ///< Spill injected, waiting for its delivery
+
+/// Canary injector and its latency histogram
+typedef struct {
+	cid_tx tx;                      ///< Modulator of the virtual line
+	int state;                      ///< CANARY_IDLE, CANARY_SEND or CANARY_WAIT
+	int period_ms;                  ///< Time between two canaries
+	int budget_ms;                  ///< Latency budget
+	int tail;                       ///< Samples of silence left after the spill
+	unsigned int seq;               ///< Sequence no. of the current canary
+	long long next_us;              ///< Start of the next canary
+	long long injected_us;          ///< First sample of the current canary was injected
+	long long sent_us;              ///< Last sample of the current canary was injected
+
+	unsigned int sent;              ///< Canaries injected
+	unsigned int delivered;         ///< Canaries delivered
+	unsigned int lost;              ///< Canaries not decoded, or too late
+	unsigned int over_budget;       ///< Canaries delivered later than budget_ms
+	unsigned int hist[CANARY_BUCKETS];      ///< Latency histogram
+	long long max_us;               ///< Largest latency
+} canary;
+
+/**@brief Initialize the canary injector.
+ */
+int canary_init(canary *c, int period_ms, int budget_ms, int rate, int baud);
+
+/**@brief Render the next block of the virtual line.
+ */
+int canary_render(canary *c, short *samples, int n);
+
+/**@brief Check a decoded message of the virtual line.
+ */
+long long canary_delivered(canary *c, const char *number);
+
+/**@brief Count the current canary as lost.
+ */
+void canary_lost(canary *c);
+
+/**@brief Latency below which a fraction of the canaries were delivered.
+ */
+int canary_percentile(const canary *c, double p);
+
+/**@brief Print the latency histogram.
+ */
+void canary_report(const canary *c, FILE *fp);
+
+#endif
@@ -0,0 +1,112 @@
+/**@file capsrc.h
+ *
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Timestamps of the sound card capture, recorded and replayed
+ */
+
+#ifndef CAPSRC_H
+#define CAPSRC_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CAPSRC_MAGIC            0x52504143U     ///< "CAPR", starts a capture recording
+#define CAPSRC_VERSION          1       ///< Version of the format
+
+#define CAPSRC_START            1       ///< Capture started (ring)
+#define CAPSRC_READ             2       ///< Block read, followed by its bytes
+#define CAPSRC_XRUN             3       ///< Frames lost before the next block
+#define CAPSRC_STOP             4       ///< Capture stopped
+
+/// Header of a capture recording, followed by the events
+struct capsrc_header {
+	uint32_t magic;                 ///< CAPSRC_MAGIC
+	uint32_t version;               ///< CAPSRC_VERSION
+	int32_t rate;                   ///< Sampling rate
+	int32_t channels;               ///< Channels of a frame
+	int32_t bits;                   ///< Bits of a sample
+	int32_t period_size;            ///< Frames of a period
+	int32_t period_count;           ///< Periods of the buffer
+	int32_t reserved;
+};
+
+/// Event of a capture recording
+struct capsrc_event {
+	uint32_t type;                  ///< CAPSRC_*
+	uint32_t frames;                ///< Frames of the block read, or lost
+	int64_t t_ns;                   ///< pcm_get_htimestamp() of the block, else the time of the event, CLOCK_MONOTONIC
+	uint32_t avail;                 ///< Frames left in the buffer at t_ns
+	uint32_t bytes;                 ///< Bytes following the event
+};
+
+/// Hardware clock of the capture, tells the frames lost by an xrun
+typedef struct {
+	int rate;                       ///< Sampling rate
+	int64_t t_ns;                   ///< Timestamp of the previous block, 0 before the first
+	uint32_t avail;                 ///< Frames left in the buffer at t_ns
+	uint32_t min_gap;               ///< Fewer lost frames are timestamp jitter
+	uint32_t xruns;                 ///< No. of xruns
+	uint64_t lost;                  ///< Frames lost by all the xruns
+} capsrc_clock;
+
+/// Capture recording being written
+typedef struct {
+	FILE *fp;                       ///< Recording, opened to append
+} capsrc_writer;
+
+/// Capture recording being replayed
+typedef struct {
+	FILE *fp;                       ///< Recording
+	struct capsrc_header hdr;       ///< Header
+	struct capsrc_event ev;         ///< Event read
+	int64_t rec_t0;                 ///< Time of the first event
+	int64_t play_t0;                ///< Time the replay started
+	int64_t late_ns;                ///< Latest delivery behind the recorded time
+} capsrc_reader;
+
+/**@brief Current time of CLOCK_MONOTONIC in nano seconds.
+ */
+int64_t capsrc_now(void);
+
+/**@brief Start the clock of a capture.
+ */
+void capsrc_clock_init(capsrc_clock *c, int rate, int period_size);
+
+/**@brief Frames lost since the previous block.
+ */
+uint32_t capsrc_clock_lost(capsrc_clock *c, int64_t t_ns, uint32_t avail, uint32_t frames);
+
+/**@brief Open a capture recording to append to.
+ */
+capsrc_writer *capsrc_create(const char *path, int rate, int channels, int bits,
+			     int period_size, int period_count);
+
+/**@brief Append an event.
+ */
+int capsrc_put(capsrc_writer *w, uint32_t type, uint32_t frames, int64_t t_ns, uint32_t avail,
+	       const void *data, uint32_t bytes);
+
+/**@brief Close a capture recording written.
+ */
+void capsrc_close(capsrc_writer *w);
+
+/**@brief Open a capture recording to replay.
+ */
+capsrc_reader *capsrc_open(const char *path);
+
+/**@brief Read the next event.
+ */
+int capsrc_next(capsrc_reader *r, void *data, uint32_t max);
+
+/**@brief Wait for the time of the event read.
+ */
+void capsrc_wait(capsrc_reader *r);
+
+/**@brief Close a capture recording replayed.
+ */
+void capsrc_free(capsrc_reader *r);
+
+#endif
@@ -0,0 +1,99 @@
+/**@file cdrstore.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Append-only store of the decoded calls
+ */
+
+#ifndef CDRSTORE_H
+#define CDRSTORE_H
+
+#include <stdint.h>
+
+#define CDR_SEG_RECORDS         65536   ///< Records in a segment
+#define CDR_BATCH               256     ///< Records written together
+#define CDR_MAX_SEGS            4096    ///< Max. segments in a store
+#define CDR_PATH_LEN            256     ///< Max. length of a path
+#define CDR_DIR_LEN             (CDR_PATH_LEN - 16)     ///< Max. length of the directory, a segment name fits after it
+#define CDR_FLUSH_MS            1000    ///< Longest time a record waits in the batch of cid_fsk
+
+#define CDR_NUM_LEN             20      ///< Size of the number and name fields
+
+/// Record of one call, 64 bytes. Text fields are padded with '\0', not terminated when full.
+struct cdr_record {
+	int64_t time_us;                ///< Time of the call, micro seconds since the Epoch
+	char number[CDR_NUM_LEN];       ///< Number as decoded
+	char name[CDR_NUM_LEN];         ///< Name as decoded (or from the directory)
+	char date_time[8];              ///< MMDDHHMM sent with the message
+	uint8_t verdict;                ///< Block/allow list verdict
+	uint8_t cksum_ok;               ///< 1 if the checksum of the message passed
+	uint16_t line;                  ///< Line the call came in on
+};
+
+/// Entry of the number index of a sealed segment
+struct cdr_index {
+	uint64_t key;                   ///< Hash of the number
+	uint32_t rec;                   ///< Record in the segment
+	uint32_t reserved;
+};
+
+/// Time range of a sealed segment, stored after its number index
+struct cdr_range {
+	int64_t min_us;                 ///< Earliest call of the segment
+	int64_t max_us;                 ///< Latest call of the segment
+};
+
+/// Segment of the store
+struct cdr_seg {
+	unsigned int seq;               ///< Segment no., also its file name
+	int sealed;                     ///< Full and indexed
+	const struct cdr_record *rec;   ///< Mapped records
+	uint32_t count;                 ///< No. of records mapped
+	const struct cdr_index *idx;    ///< Mapped number index, then its cdr_range (sealed only)
+	int idx_heap;                   ///< Index built in memory by a read-only store
+	int64_t min_us, max_us;         ///< Time range of the records (sealed only)
+};
+
+/// Store in a directory, one file per segment
+typedef struct {
+	char dir[CDR_DIR_LEN];                  ///< Directory of the store
+	int rdonly;                             ///< Opened for queries only
+	int fd;                                 ///< Active segment, opened for append
+	uint32_t active_count;                  ///< Records in the active segment (written)
+	struct cdr_record batch[CDR_BATCH];     ///< Records not written yet
+	int nbatch;
+	struct cdr_seg seg[CDR_MAX_SEGS];       ///< All segments, oldest first
+	int nseg;
+} cdr_store;
+
+/// Callback of a query, return non zero to stop
+typedef int (*cdr_callback)(const struct cdr_record *r, void *arg);
+
+/**@brief Open (or create) the store in a directory.
+ */
+cdr_store *cdr_open(const char *dir);
+
+/**@brief Open the store in a directory for queries only.
+ */
+cdr_store *cdr_open_rdonly(const char *dir);
+
+/**@brief Append a record.
+ */
+int cdr_append(cdr_store *st, const struct cdr_record *r);
+
+/**@brief Write the batched records.
+ */
+int cdr_flush(cdr_store *st);
+
+/**@brief Find the calls from a number in a time range.
+ */
+int cdr_query(cdr_store *st, const char *number, int64_t since_us, int64_t until_us,
+	      cdr_callback cb, void *arg);
+
+/**@brief Flush and close the store.
+ */
+void cdr_close(cdr_store *st);
+
+#endif
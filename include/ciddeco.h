@@ -18,6 +18,17 @@
 #define CID_SIG_V23             0                               ///< Caller ID standard 
 #define CID_BELLCORE_FSK        1                               ///< Caller ID standard used in US
 
+#define MDMF                    0x80                            ///< Multiple data message format
+#define	SDMF                    0x04                            ///< Simple data message format
+
+#define DATE_TIME               0x01                            ///< Parameter type Date & time
+#define NAME                    0x07                            ///< Parameter type Name
+#define NO_NAME                 0x08                            ///< Parameter type Name not present
+#define NUM                     0x02                            ///< Parameter type Phone number
+#define NO_NUM                  0x04                            ///< Parameter type Number not present
+
+#define CID_OLDSTUFF            1000                            ///< Samples carried to the next feed
+
 /**@brief Wav file header
  *
  * The header is the beginning of a WAV (RIFF) file. The header is used 
@@ -40,11 +51,15 @@ typedef struct wav_header{
     uint32_t datachunk_size;
 }wav_header;
 
+struct line_params;
+
 /// Parameters for FSK Demodulation
 typedef struct param{
 	int samp_rate;                  ///< Sampling frequency can be 8kHz, 16kHz, 19.2kHz, 44.1kHz
 	int baud_rate;	                ///< Typical Baud rate is 1200
 	float ispb;                     ///< No. of samples required to get a data bit(sample_rate/baud_rate)
+	int engine;                     ///< Demodulation engine of the lines (FSK_ENGINE_*)
+	const struct line_params *seed; ///< Learned parameters of the line, NULL for a cold start
 }param;
 
 /// PCM capture parameters
@@ -71,7 +86,7 @@ struct callerid_state {
 
 	fsk_data fskd;                  ///< Structure containing parameters for FSK modulation
 	int rawdata[256];               ///< buffer to store the CID data bytes
-	short oldstuff[1000];           ///< buffer to store previous samples
+	short oldstuff[CID_OLDSTUFF];   ///< buffer to store previous samples
 	int oldlen;					
 	int pos;
 	int type;
@@ -82,19 +97,38 @@ struct callerid_state {
 	int flags;	
 	int sawflag;                    ///< Flag for the decoding state machine
 	int len;
+	int msg_type;                   ///< MDMF or SDMF, from the first byte
+	int msg_off;                    ///< Next byte of rawdata
+	int data_type;                  ///< Type of the current field
+	int data_len;                   ///< Length of the current field
+	int data_field;                 ///< Bytes of the current field still to come
+	int name_field;                 ///< 1 once the name field was seen
+	int number_field;               ///< 1 once the number field was seen
 
 	int skipflag; 
 	unsigned short crc;
+	int verdict;                    ///< Block/allow list verdict of the number
+	int cksum_ok;                   ///< 1 if the checksum of the message passed
+	short *work;                    ///< Scratch of callerid_feed(), NULL to malloc it
+	int worklen;                    ///< Samples in work
 };
 
 /** @brief Create a callerID state machine
  */
 struct callerid_state *callerid_new(int cid_signalling, param *demod_param);
 
+/** @brief Initialize a zeroed callerID state machine in place
+ */
+void callerid_init(struct callerid_state *cid, int cid_signalling, param *demod_param);
+
 /** @brief Read samples into the state machine.
  */
 int callerid_feed(struct callerid_state *cid, unsigned char *ubuf, int len);
 
+/** @brief Tell the state machine samples were lost before the next ones.
+ */
+int callerid_gap(struct callerid_state *cid, int n);
+
 /** @brief This function frees callerid_state cid.
  */
 void callerid_free(struct callerid_state *cid);
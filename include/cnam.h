@@ -0,0 +1,71 @@
+/**@file cnam.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Caller name cache filled asynchronously from a directory service
+ */
+
+#ifndef CNAM_H
+#define CNAM_H
+
+#include <pthread.h>
+#include <time.h>
+
+#define CNAM_SLOTS              4096    ///< Entries in the cache
+#define CNAM_HASH               8192    ///< Hash buckets, power of 2
+#define CNAM_QUEUE              64      ///< Lookups waiting for the directory
+#define CNAM_LEN                32      ///< Max. length of a number or a name
+#define CNAM_TTL                86400   ///< Seconds a name is kept
+#define CNAM_NEG_TTL            3600    ///< Seconds a number without name is kept
+#define CNAM_TIMEOUT_MS         2000    ///< Max. time of one directory lookup
+#define CNAM_MAX_REPLY          1024    ///< Max. bytes read for a name, the end of line included
+
+#define CNAM_EMPTY              0       ///< Slot not in use
+#define CNAM_PENDING            1       ///< Lookup in progress
+#define CNAM_FOUND              2       ///< Name known
+#define CNAM_NEGATIVE           3       ///< Directory has no name for the number
+
+/// Entry of the cache
+struct cnam_entry {
+	char number[CNAM_LEN];          ///< Key of the entry
+	char name[CNAM_LEN];            ///< Name from the directory
+	int state;                      ///< CNAM_EMPTY, PENDING, FOUND or NEGATIVE
+	int ref;                        ///< Used since the clock hand last passed
+	time_t expires;                 ///< Entry is a miss after this time
+	int next;                       ///< Next slot in the same hash bucket, -1 at the end
+};
+
+/// Cache keyed by number, with CLOCK replacement and a lookup thread
+typedef struct {
+	struct cnam_entry slot[CNAM_SLOTS];     ///< Entries
+	int bucket[CNAM_HASH];                  ///< First slot of every hash bucket
+	int hand;                               ///< Clock hand
+	int queue[CNAM_QUEUE];                  ///< Slots waiting for the directory
+	int q_head, q_tail;
+	char sock_path[108];                    ///< UNIX socket of the directory service
+	int stop;                               ///< Lookup thread must exit
+	pthread_mutex_t lock;
+	pthread_cond_t wake;                    ///< Signals the lookup thread
+	pthread_cond_t done;                    ///< Signals a completed lookup
+	pthread_t thread;
+} cnam_cache;
+
+/**@brief Create the cache and start its lookup thread.
+ */
+cnam_cache *cnam_new(const char *sock_path);
+
+/**@brief Start the lookup of a number without waiting for it.
+ */
+void cnam_prefetch(cnam_cache *c, const char *number);
+
+/**@brief Get the name of a number from the cache.
+ */
+int cnam_get(cnam_cache *c, const char *number, char *name, int wait_ms);
+
+/**@brief Stop the lookup thread and free the cache.
+ */
+void cnam_free(cnam_cache *c);
+
+#endif
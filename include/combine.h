@@ -0,0 +1,37 @@
+/**@file combine.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Diversity combining of the two captured channels
+ */
+
+#ifndef COMBINE_H
+#define COMBINE_H
+
+#define COMBINE_OFF             0       ///< Use the first channel only
+#define COMBINE_SELECT          1       ///< Use the channel with the better SNR
+#define COMBINE_MRC             2       ///< Maximal-ratio combining of both channels
+
+#define COMBINE_ALPHA           0.25    ///< Smoothing of the power estimates per block
+
+/// State of the two channel combiner
+typedef struct {
+	int mode;                       ///< COMBINE_OFF, COMBINE_SELECT or COMBINE_MRC
+	int primed;                     ///< Power estimates are valid
+	double pow[2];                  ///< Power of every channel
+	double cross;                   ///< Cross power of the two channels (common signal)
+	double snr[2];                  ///< Estimated SNR of every channel
+	double w[2];                    ///< Weight applied to every channel
+} diversity;
+
+/**@brief Initialize the combiner.
+ */
+void diversity_init(diversity *d, int mode);
+
+/**@brief Combine interleaved stereo frames into a single channel.
+ */
+int diversity_combine(diversity *d, const short *frames, int nframes, short *out);
+
+#endif
@@ -0,0 +1,77 @@
+/**@file ctlsock.h
+ *
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Control socket arming the line from the ring controller
+ */
+
+#ifndef CTLSOCK_H
+#define CTLSOCK_H
+
+#include <sys/un.h>
+
+#define CTL_PREROLL_MS          200     ///< Demodulation starts this long before the end of the ring
+#define CTL_HISTORY_MS          5000    ///< Captured samples kept for the pre-roll
+#define CTL_ARM_MS              4000    ///< Demodulation after the end of the ring, same as alarm(4)
+#define CTL_MSG_LEN             128     ///< Longest command
+#define CTL_MAX_GAPS            16      ///< Gaps of the capture kept with the history
+
+/// Frames lost by an xrun of the capture
+struct ctl_gap {
+	long long pos;                  ///< Sample of the history right after the gap
+	unsigned int frames;            ///< Frames lost
+};
+
+/// Samples captured on the line, with the time of the last one
+typedef struct {
+	short *s;                       ///< Ring of samples
+	int len;                        ///< Samples in the ring
+	int rate;                       ///< Sampling rate
+	long long count;                ///< Samples written since the start
+	long long end_us;               ///< Time of the last sample, micro seconds since the Epoch
+	struct ctl_gap gap[CTL_MAX_GAPS];       ///< Last gaps, the oldest overwritten
+	int ngaps;                      ///< Gaps recorded since the start
+} ctl_history;
+
+/// Control socket of a line
+typedef struct {
+	int fd;                         ///< Unix datagram socket
+	int line;                       ///< Line decoded by this process
+	struct sockaddr_un addr;        ///< Bound address
+} ctl_sock;
+
+/**@brief Open the control socket of a line.
+ */
+ctl_sock *ctl_open(const char *path, int line);
+
+/**@brief Read the pending commands.
+ */
+int ctl_poll(ctl_sock *c, long long *ring_end_us);
+
+/**@brief Close and remove the control socket.
+ */
+void ctl_close(ctl_sock *c);
+
+/**@brief Initialize the history of the captured samples.
+ */
+void ctl_history_init(ctl_history *h, short *s, int len, int rate);
+
+/**@brief Append captured samples to the history.
+ */
+void ctl_history_put(ctl_history *h, const short *s, int n, long long end_us);
+
+/**@brief Record frames lost before the next samples of the history.
+ */
+void ctl_history_gap(ctl_history *h, unsigned int frames);
+
+/**@brief Position in the history of a time.
+ */
+long long ctl_history_at(const ctl_history *h, long long t_us);
+
+/**@brief Read samples from the history.
+ */
+int ctl_history_get(const ctl_history *h, long long *pos, short *out, int max, unsigned int *gap);
+
+#endif
@@ -0,0 +1,27 @@
+/**@file fft.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Radix-2 FFT
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+/// Complex value
+typedef struct {
+	float re;                               ///< Real part
+	float im;                               ///< Imaginary part
+} fft_cpx;
+
+/**@brief Twiddle factors of an FFT of n points.
+ */
+int fft_twiddles(fft_cpx *tw, int n);
+
+/**@brief In place FFT of n points.
+ */
+void fft(fft_cpx *x, const fft_cpx *tw, int n, int inverse);
+
+#endif
@@ -289,4 +289,24 @@ static const double d_coef_lp_1700hz_16 [NZEROS_POLES + 1] = {-0.0712022265,
 
 
 
+/************************************************************************************************/
+/****************************************** FIR *************************************************/
+/************************************************************************************************/
+
+
+/**@brief Design parameters of the FIR filters (FSK_ENGINE_FIR)
+ *
+ * Unlike the IIR sets above, the FIR filters are not tabulated: fskmodem_init()
+ * designs them for the rate of the demodulator, as Hamming windowed sinc
+ * filters of FSK_FIR_TAPS - 1 taps (linear phase, delay of half of that).
+ * The Mark and Space bandpass filters are BW wide around their frequency and
+ * have a gain of 1 there, the low pass filter has a gain of 1 at DC.
+ */
+#define FIR_MARK_HZ_BELL        1200    ///< Mark frequency, Bell 202
+#define FIR_SPACE_HZ_BELL       2200    ///< Space frequency, Bell 202
+#define FIR_MARK_HZ_V23         1300    ///< Mark frequency, V.23
+#define FIR_SPACE_HZ_V23        2100    ///< Space frequency, V.23
+#define FIR_LP_HZ               1000    ///< Corner of the low pass filter
+
+
 #endif
@@ -0,0 +1,76 @@
+/**@file fskbatch.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Batch bit slicer for many lines
+ *
+ * @note Includes code and algorithms from the Zapata library and Aesterisk.
+ */
+
+#ifndef FSKBATCH_H
+#define FSKBATCH_H
+
+#include <stdint.h>
+#include "fskmodem.h"
+
+#define FSK_BATCH_LANES         16      ///< Max. no. of lines sliced in lockstep
+#define FSK_BITQ_SIZE           64      ///< Bits queued per line, one 64 bit word
+#define FSK_BATCH_CHUNK         (2 * FSK_FFT_BLOCK)     ///< Frames demodulated per line at once
+#define FSK_BATCH_GATE          64      ///< Default mean level below which an idle line is not demodulated
+#define FSK_BATCH_HOLD          4       ///< Chunks a line stays active after a byte was framed
+
+/// Queue of sliced bits waiting for the byte framer of a line
+struct fsk_bitq {
+	uint64_t word;                          ///< Bit n % 64 holds bit n, 1 for Mark, 0 for Space
+	unsigned int head;                      ///< Write position of the slicer
+	unsigned int tail;                      ///< Read position of the framer
+	unsigned int overrun;                   ///< Bits dropped because the framer was late
+	unsigned int framing;                   ///< Start bits without their stop bits
+};
+
+/** @brief DPLL state of all the lines, one array element (lane) per line.
+ *
+ * The fields are kept as separate arrays so that every line is advanced
+ * with the same instructions and the compiler can vectorize the lanes.
+ */
+typedef struct {
+	int nlines;                             ///< Lines in use (<= FSK_BATCH_LANES)
+	fsk_data *fskd[FSK_BATCH_LANES];        ///< Filters of every line
+	int gate;                               ///< Mean level of a chunk making a line active
+	unsigned int active;                    ///< Bit l set if line l was demodulated in the last chunk
+	unsigned long long idle[FSK_BATCH_LANES];       ///< Chunks a line was skipped
+	int hold[FSK_BATCH_LANES];              ///< Chunks a line stays active, set by the framer
+
+	int dem[FSK_BATCH_LANES][FSK_BATCH_CHUNK];      ///< Demodulated values of the current chunk
+	int ix[FSK_BATCH_LANES];                ///< Current demodulated value
+	int xi0[FSK_BATCH_LANES];               ///< Previous demodulated value
+	int icont[FSK_BATCH_LANES];             ///< Count for DPLL
+	int pllispb[FSK_BATCH_LANES];           ///< Pll autosense
+	int pllids[FSK_BATCH_LANES];            ///< PLL adjustment
+	int pllispb2[FSK_BATCH_LANES];          ///< Center of the PLL
+	int adjusted[FSK_BATCH_LANES];          ///< All 1s once DPLL is adjusted in a bit
+	int wrap[FSK_BATCH_LANES];              ///< All 1s when a bit ends at this sample
+	int quiet[FSK_BATCH_LANES];             ///< Samples of a line under the gate, in a row
+
+	struct fsk_bitq q[FSK_BATCH_LANES];     ///< Sliced bits of every line
+} fsk_batch;
+
+/**@brief Initialize the batch slicer for nlines lines.
+ */
+int fsk_batch_init(fsk_batch *b, fsk_data **lines, int nlines);
+
+/**@brief Slice interleaved frames of all the lines.
+ */
+int fsk_batch_feed(fsk_batch *b, const short *frames, int nframes);
+
+/**@brief Get the next sliced bit of a line.
+ */
+int fsk_batch_get_bit(fsk_batch *b, int line);
+
+/**@brief Frame the next byte of a line from its queued bits.
+ */
+int fsk_batch_get_byte(fsk_batch *b, int line);
+
+#endif
@@ -19,6 +19,41 @@
                                 zeros constant we are using 3rd order Bandpass
                                 and 6th order Low-pass for demodulation */
 
+#define FSK_ENGINE_IIR          0       ///< Direct form IIR in double precision (reference)
+#define FSK_ENGINE_IIR_SP       1       ///< Direct form IIR in single precision
+                                        // 2 was a block state-space IIR, no faster than FSK_ENGINE_IIR,
+                                        // the numbers stay as they are in the spill archives
+#define FSK_ENGINE_FIR          3       ///< Linear phase FIR, designed at start up
+#define FSK_ENGINE_FFT          4       ///< FSK_ENGINE_FIR filters by overlap-save FFT, for recordings
+#define FSK_ENGINES             5       ///< No. of demodulation engines
+#define FSK_BAUD                1200    ///< Bit rate of the spills, Bell 202 and V.23
+#define FSK_PLL_GAIN            16      ///< DPLL moved by 1/FSK_PLL_GAIN bit on a transition
+#define FSK_FRAME_BITS          13      ///< Bits of samples fsk_serial() needs for a byte, 11 and the slips of the DPLL
+#define FSK_ENGINE_SOFTBIT      5       ///< Replays the signs recorded in fsk_data::runs, see softbit.c
+
+#define FSK_FIR_TAPS            64      ///< Window of the FIR filters, a multiple of the vector size
+#define FSK_FIR_ALIGN           16      ///< Alignment of the FIR coefficients, what malloc() gives
+#define FSK_FFT_SIZE            256     ///< Points of the FFT of FSK_ENGINE_FFT, a power of 2
+#define FSK_FFT_BLOCK           (FSK_FFT_SIZE - FSK_FIR_TAPS + 1)       ///< New samples per FFT, the rest is history
+
+#define FSK_RUNS_MIN            1024    ///< Runs allocated first by the recording of a spill
+#define FSK_UNITY_GAIN          256     ///< Input gain of 1, the gain is in 1/256
+#define FSK_WARM_SEIZURE_BITS   40      ///< Channel seizure bits enough on a warm started line
+#define FSK_WARM_MARK_BITS      20      ///< Mark bits enough on a warm started line
+#define FSK_GAP_MAX_BITS        40      ///< Longest gap concealed in the seizure or the Mark signal
+#define FSK_GAP_SETTLE_BITS     3       ///< Bits after a gap not checked, the filters settle
+#define FSK_GAP_MIN_LEARN       16      ///< Seizure bits measured enough to count a gap with their period
+#define FSK_SEARCH_BITS         8       ///< Seizure bits before the line is no longer searching
+
+/// What the current spill measured during the channel seizure, see lineparm.c
+struct fsk_learn {
+	double sum;                             ///< Sum of the input samples
+	double tone;                            ///< Sum of the squared Mark and Space filter values
+	int nsamp;                              ///< Samples measured
+	int nbits;                              ///< Bits measured
+	int done;                               ///< 1 once the channel seizure is detected
+};
+
 /// new filter structure
 struct filter_struct {
 
@@ -27,6 +62,41 @@ struct filter_struct {
         double 	xv[NZEROS_POLES + 1];           ///< array to store previous input values
         double 	yv[NZEROS_POLES + 1];           ///< array to store previous output values
         double 	gain;                           ///< Gain of the filter
+
+        float   c_sp[NZEROS_POLES + 1];         ///< 'c' coefficients for FSK_ENGINE_IIR_SP
+        float   d_sp[NZEROS_POLES + 1];         ///< 'd' coefficients for FSK_ENGINE_IIR_SP
+        float   xs[NZEROS_POLES + 1];           ///< previous inputs for FSK_ENGINE_IIR_SP
+        float   ys[NZEROS_POLES + 1];           ///< previous outputs for FSK_ENGINE_IIR_SP
+        float   inv_gain_sp;                    ///< 1 / gain for FSK_ENGINE_IIR_SP
+};
+
+/// FIR filter of FSK_ENGINE_FIR
+struct fir_struct {
+        float   h[FSK_FIR_TAPS] __attribute__ ((aligned(FSK_FIR_ALIGN)));      ///< Coefficients, oldest sample first
+        float   w[2 * FSK_FIR_TAPS];            ///< Window of inputs, stored twice so it is never split
+        int     pos;                            ///< Oldest input of the window
+};
+
+/// Signs of the demodulated values of a spill, in the order the slicer got them, see softbit.c
+struct fsk_runs {
+	unsigned short *run;                    ///< Lengths of the runs of the same sign, Space first
+	int max;                                ///< Size of run[]
+	int n;                                  ///< No. of runs
+	int pos;                                ///< Run replayed by FSK_ENGINE_SOFTBIT
+	int used;                               ///< Values of run[pos] already replayed
+};
+
+/// Samples demodulated ahead by FSK_ENGINE_FFT, see fskmodem.c
+struct fsk_ahead {
+	const short *at;                        ///< Sample the next value in the queue belongs to
+	int n;                                  ///< Values in the queue, 0 if it is empty
+	int k;                                  ///< Values of the queue already used
+	int is[FSK_FFT_BLOCK];                  ///< Space filter values
+	int im[FSK_FFT_BLOCK];                  ///< Mark filter values
+	int ilin[FSK_FFT_BLOCK];                ///< Difference of the squared values
+	int id[FSK_FFT_BLOCK];                  ///< Demodulated values
+	int x[FSK_FFT_BLOCK];                   ///< Inputs of the FIR filters, FSK_ENGINE_FFT only
+	float d[FSK_FFT_BLOCK];                 ///< Inputs of the FIR low pass filter, FSK_ENGINE_FFT only
 };
 
 typedef struct {
@@ -35,23 +105,37 @@ typedef struct {
 	int instop;                             ///< Number of Stop Bits  
 	int ispb;                               ///< Sample per FSK bit (Sample_rate/baud_rate)
 	int fsk_std;                            ///< Type of FSK standard
+	int engine;                             ///< Demodulation engine (FSK_ENGINE_*)
 	
 	int xi0;                                ///< current demodulated value
 	int xi1;                                ///< previous demodulated value
 	int xi2;                                ///< previous to previous demodulated value
 	
 	int state;                              ///< Demodulation state
+	int count;                              ///< Count for Channel Seizure and Mark Signal bits
+	int one_zero;                           ///< Balance of 1s and 0s in the Channel Seizure
+	int resync;                             ///< Bits after a gap not checked yet, see fsk_gap()
+	int hunt;                               ///< 1 while the DPLL waits for the edge of a start bit
 
 	int pllispb;                            ///< Pll autosense 
+	int pllnominal;                         ///< pllispb of the baud rate, before lineparm_seed()
 	int pllids;                             ///< PLL adjustment
 	int pllispb2;                           ///< Center of the PLL
 	int icont;                              ///< Count for DPLL
-	int pll_round_off;                      /**< SPB is in float, so for proper PLL, round
-                                                of is necessary */
+
+	int gain;                               ///< Input gain (AGC) in 1/256
+	int dc;                                 ///< DC offset removed from the input
+	int warm;                               ///< 1 if seeded with the learned parameters of the line
+	struct fsk_learn learn;                 ///< Measurements of the current spill
+	struct fsk_ahead ahead;                 ///< Block of samples demodulated ahead
+	struct fsk_runs *runs;                  ///< Signs recorded, or replayed, NULL if none
 
 	struct filter_struct mark_filter;       ///< Structure to store mark filter data
 	struct filter_struct space_filter;      ///< Structure to store space filter data
 	struct filter_struct demod_filter;      ///< Structure to store demodulator filter data
+	struct fir_struct mark_fir;             ///< Mark filter of FSK_ENGINE_FIR
+	struct fir_struct space_fir;            ///< Space filter of FSK_ENGINE_FIR
+	struct fir_struct demod_fir;            ///< Low pass filter of FSK_ENGINE_FIR
 
 } fsk_data;
 
@@ -59,9 +143,37 @@ typedef struct {
  */
 int fsk_serial(fsk_data *fskd, short *buffer, int *len, int *outbyte);
 
+/**@brief Conceal samples lost by an xrun.
+ */
+int fsk_gap(fsk_data *fskd, short *buffer, int len, int n);
+
 
 /**@brief Initialize the FSK data 
  */
 int fskmodem_init(fsk_data *fskd);
 
+/**@brief Set up the FSK data of a line and initialize its demodulator
+ */
+void fsk_line_init(fsk_data *fskd, float ispb, int fsk_std, int engine);
+
+/**@brief Demodulate a single sample through the line's filters.
+ */
+int fsk_demodulate(fsk_data *fskd, int x);
+
+/**@brief Demodulate a block of samples through the line's filters.
+ */
+int fsk_demod_block(fsk_data *fskd, const short *in, int *out, int n);
+
+/**@brief Name of a demodulation engine.
+ */
+const char *fsk_engine_name(int engine);
+
+/**@brief Demodulation engine from its name, -1 if unknown.
+ */
+int fsk_engine_lookup(const char *name);
+
+/**@brief Tell if the line is still searching for the start of a spill.
+ */
+int fsk_searching(const fsk_data *fskd);
+
 #endif 
@@ -0,0 +1,73 @@
+/**@file fsktx.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief FSK Modulation of CallerID spills for many ports
+ */
+
+#ifndef FSKTX_H
+#define FSKTX_H
+
+#include <stdint.h>
+
+#define TX_SINE_BITS            10                      ///< log2 of the sine table size
+#define TX_SINE_SIZE            (1 << TX_SINE_BITS)     ///< Entries of the sine table
+
+#define TX_SEIZURE_BITS         300     ///< Alternate 0s and 1s of the channel seizure
+#define TX_MARK_BITS            180     ///< 1s of the Mark signal
+#define TX_STOP_BITS            2       ///< Mark bits after every byte
+#define TX_MAX_MSG              256     ///< Max. bytes of a CID message
+#define TX_MAX_BITS             (TX_SEIZURE_BITS + TX_MARK_BITS + \
+                                TX_MAX_MSG * (9 + TX_STOP_BITS))
+#define TX_MAX_PORTS            64      ///< Max. ports rendered by one transmitter
+#define TX_DELAY_MS             500     ///< Default start of the spill after the ring
+
+#define TX_IDLE                 0       ///< Nothing to send
+#define TX_WAIT                 1       ///< Spill scheduled, waiting for its start time
+#define TX_SEND                 2       ///< Sending the spill
+
+/// State of a port sending a spill
+struct cid_tx_port {
+	int state;                      ///< TX_IDLE, TX_WAIT or TX_SEND
+	long long start;                ///< Sample time of the first sample of the spill
+	uint32_t phase;                 ///< Phase of the NCO, a full turn is 2^32
+	uint32_t inc[2];                ///< Phase increment for Space (0) and Mark (1)
+	uint32_t bit_clock;             ///< Phase of the bit clock, a bit is 2^32
+	uint32_t bit_step;              ///< Bit clock increment per sample (baud/rate)
+	int amp;                        ///< Amplitude of the sine wave
+	int bit;                        ///< Index of the bit being sent
+	int nbits;                      ///< No. of bits in the spill
+	unsigned char bits[TX_MAX_BITS];        ///< Bits of the spill, 1 for Mark
+};
+
+/// Transmitter rendering the spills of many ports into one multichannel period
+typedef struct {
+	int rate;                       ///< Sampling rate of the output
+	int baud;                       ///< Baud rate, typically 1200
+	int fsk_std;                    ///< FSK standard, same as fsk_data fsk_std
+	int nports;                     ///< No. of ports, one channel each
+	long long now;                  ///< Sample time of the next frame rendered
+	struct cid_tx_port port[TX_MAX_PORTS];  ///< State of every port
+} cid_tx;
+
+/**@brief Initialize the transmitter.
+ */
+int cid_tx_init(cid_tx *tx, int nports, int rate, int baud, int fsk_std, int amp);
+
+/**@brief Build a CID message with its checksum.
+ */
+int cid_msg_build(unsigned char *msg, int type, const char *date_time,
+		  const char *number, const char *name);
+
+/**@brief Schedule a spill on a port relative to the end of the ring.
+ */
+int cid_tx_ring(cid_tx *tx, int port, long long ring_end, int delay_ms,
+		const unsigned char *msg, int len);
+
+/**@brief Render the next frames of all the ports.
+ */
+int cid_tx_render(cid_tx *tx, short *frames, int nframes);
+
+#endif
@@ -0,0 +1,51 @@
+/**@file lineparm.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Parameters learned on every line, kept to warm start the next spill
+ */
+
+#ifndef LINEPARM_H
+#define LINEPARM_H
+
+#include <stdint.h>
+#include "fskmodem.h"
+
+#define LINEPARM_MAGIC          0x4d52504cU     ///< "LPRM", marks a used record
+#define LINEPARM_MAX_LINES      4096    ///< Lines in a parameter file
+#define LINEPARM_MIN_BITS       100     ///< Seizure bits needed to learn from a spill
+#define LINEPARM_SHIFT          2       ///< New measurements weigh 1/4
+#define LINEPARM_TARGET_TONE    10000   ///< RMS of the Mark and Space filters the DPLL works best at
+#define LINEPARM_MIN_GAIN       (FSK_UNITY_GAIN / 4)    ///< Lowest gain learned
+#define LINEPARM_MAX_GAIN       (FSK_UNITY_GAIN * 8)    ///< Highest gain learned
+#define LINEPARM_MIN_BAUD_ERR   15      ///< Smaller baud errors are measurement noise, in 1/1000
+#define LINEPARM_MAX_BAUD_ERR   50      ///< Largest baud error learned, in 1/1000
+
+/// Learned parameters of one line, one record per line in the file
+struct line_params {
+	uint32_t magic;                 ///< LINEPARM_MAGIC once the line learned a spill
+	uint32_t spills;                ///< Spills learned from
+	int32_t gain;                   ///< Input gain in 1/256
+	int32_t dc;                     ///< DC offset of the input
+	int32_t pllispb;                ///< DPLL period in 1/32 sample
+};
+
+/**@brief Read the learned parameters of a line.
+ */
+int lineparm_load(const char *path, int line, struct line_params *lp);
+
+/**@brief Write the learned parameters of a line.
+ */
+int lineparm_save(const char *path, int line, const struct line_params *lp);
+
+/**@brief Seed the FSK data of a new spill with the learned parameters.
+ */
+void lineparm_seed(fsk_data *fskd, const struct line_params *lp);
+
+/**@brief Update the learned parameters with what the spill measured.
+ */
+int lineparm_learn(struct line_params *lp, fsk_data *fskd);
+
+#endif
@@ -0,0 +1,91 @@
+/**@file numlist.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Memory-mapped block/allow list of numbers and prefixes
+ */
+
+#ifndef NUMLIST_H
+#define NUMLIST_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define NUMLIST_MAGIC           0x4e444943      ///< "CIDN"
+#define NUMLIST_VERSION         1
+#define NUMLIST_DIGITS          15              ///< Max. digits of a number (E.164)
+#define NUMLIST_BUCKET_BITS     16              ///< Top bits of the key indexing the buckets
+#define NUMLIST_BUCKETS         (1 << NUMLIST_BUCKET_BITS)
+#define NUMLIST_NONE            0xffffffff      ///< No parent prefix
+
+#define NUMLIST_UNKNOWN         0               ///< Number is not in the list
+#define NUMLIST_BLOCK           1               ///< Block the call
+#define NUMLIST_ALLOW           2               ///< Allow the call
+
+#define NUMLIST_PREFIX          0               ///< Entry matches every number starting with it
+#define NUMLIST_EXACT           1               ///< Entry matches only the same number
+
+/** @brief Entry of the list.
+ *
+ * The key holds the digits as nibbles (digit + 1) from the top, so that
+ * sorting the keys sorts the numbers and a prefix comes before every number
+ * starting with it. The low nibble is NUMLIST_PREFIX or NUMLIST_EXACT.
+ */
+struct numlist_entry {
+	uint64_t key;                           ///< Digits and kind of the entry
+	uint32_t parent;                        ///< Index of the longest prefix entry of this entry
+	uint32_t verdict;                       ///< NUMLIST_BLOCK or NUMLIST_ALLOW
+};
+
+/// Header of the list file, followed by count sorted entries
+struct numlist_header {
+	uint32_t magic;                         ///< NUMLIST_MAGIC
+	uint32_t version;                       ///< NUMLIST_VERSION
+	uint64_t count;                         ///< No. of entries
+	uint32_t bucket[NUMLIST_BUCKETS + 1];   ///< First entry of every value of the top key bits
+};
+
+/// One mapping of the list file
+struct numlist_map {
+	void *base;                             ///< Start of the mapping
+	size_t size;                            ///< Size of the mapping
+	const struct numlist_header *hdr;       ///< Header of the file
+	const struct numlist_entry *e;          ///< Sorted entries
+	dev_t dev;                              ///< File the mapping comes from
+	ino_t ino;
+};
+
+/// List loaded from a file, replaced when the file is renamed over
+typedef struct {
+	char path[256];                         ///< Path of the list file
+	struct numlist_map *cur;                ///< Mapping in use by lookups
+	struct numlist_map *old;                ///< Previous mapping, unmapped at the next refresh
+} numlist;
+
+/**@brief Map a list file.
+ */
+numlist *numlist_open(const char *path);
+
+/**@brief Map the list file again if it was replaced.
+ */
+int numlist_refresh(numlist *nl);
+
+/**@brief Look up a number in the list.
+ */
+int numlist_lookup(numlist *nl, const char *number);
+
+/**@brief Unmap and free the list.
+ */
+void numlist_close(numlist *nl);
+
+/**@brief Build a list file from a text file.
+ */
+int numlist_build(const char *txt_path, const char *path);
+
+/**@brief Name of a verdict.
+ */
+const char *numlist_verdict_name(int verdict);
+
+#endif
@@ -0,0 +1,70 @@
+/**@file pipeline.h
+ *
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Pipeline of the stages a block of the line goes through
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include "fskmodem.h"
+#include "ciddeco.h"
+#include "resample.h"
+#include "spillarc.h"
+#include "profile.h"
+
+#define PIPE_MAX_NODES          8       ///< Max. no. of stages of a pipeline
+#define PIPE_GATE_PEAK          64      ///< Default peak below which the gate drops a block
+
+struct pipe_node;
+struct pipeline;
+
+/// Kernel of a sample stage, runs in the loop of its group over the block
+typedef int (*pipe_sample_fn)(struct pipe_node *nd, int x);
+
+/// Block stage, or end of the block for a sample stage: 0 to go on, 1 to stop
+typedef int (*pipe_block_fn)(struct pipe_node *nd, short **s, int *n);
+
+/// Stage of a pipeline
+struct pipe_node {
+	const char *name;               ///< Name in the spec
+	pipe_sample_fn sample;          ///< Kernel, NULL for a block stage
+	pipe_block_fn block;            ///< Block stage, or end of block of a sample stage, can be NULL
+	double arg;                     ///< Argument of the spec ("gain=2"), else the default
+	int peak;                       ///< Gate: peak of the block
+	struct pipeline *pl;            ///< Pipeline of the stage
+};
+
+/// Stages of a line, from the captured block to the decoder
+typedef struct pipeline {
+	struct pipe_node node[PIPE_MAX_NODES];  ///< Stages, in order
+	int n;                          ///< No. of stages
+	int group[PIPE_MAX_NODES + 1];  ///< First stage of every group, and n. A group of sample
+	int ngroups;                    ///< stages is run fused, one loop over the block
+	struct callerid_state *cs;      ///< Decoder of the line
+	resampler *rs;                  ///< Resampler of the line, NULL if none
+	short *rs_buf;                  ///< Resampled samples
+	spillarc_writer *arcw;          ///< Audio of the spill, NULL if not archived
+	int res;                        ///< Result of the decoder for the last block
+	unsigned long long blocks;      ///< Blocks run
+	unsigned long long dropped;     ///< Blocks dropped by the gate
+} pipeline;
+
+/**@brief Build the pipeline of a line from its spec.
+ */
+int pipeline_init(pipeline *pl, const char *spec, struct callerid_state *cs, resampler *rs,
+		  short *rs_buf, spillarc_writer *arcw);
+
+/**@brief Run a block of the line through the pipeline.
+ */
+int pipeline_run(pipeline *pl, short *s, int n);
+
+/**@brief Print the stages and the groups run fused.
+ */
+void pipeline_report(const pipeline *pl, FILE *fp);
+
+#endif
@@ -0,0 +1,43 @@
+/**@file profile.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Host profile with the decoder configuration tuned for the machine
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#define CID_PROFILE_PATH        "/etc/cid_fsk.profile"  ///< Loaded at startup if present
+
+#define PROFILE_PERIOD_SIZE     64      ///< Default frames per capture period
+#define PROFILE_PERIOD_COUNT    4       ///< Default periods in the capture buffer
+#define PROFILE_MIN_PERIOD      64      ///< Smallest period accepted from a profile
+#define PROFILE_MAX_PERIOD      8192    ///< Largest period accepted from a profile
+#define PROFILE_PIPELINE        "tap,resample,decode"   ///< Default stages of a line, see pipeline.c
+#define PROFILE_PIPELINE_LEN    64      ///< Max. length of a pipeline spec
+
+/// Decoder configuration of the host, written by cid_tune
+typedef struct {
+	int period_size;                ///< Frames per capture period (block size)
+	int period_count;               ///< Periods in the capture buffer
+	int engine;                     ///< Demodulation engine (FSK_ENGINE_*)
+	double ns_per_sample;           ///< Measured cost of the configuration, 0 if unknown
+	char pipeline[PROFILE_PIPELINE_LEN];    ///< Stages of a line
+} cid_profile;
+
+/**@brief Default configuration, used when there is no profile.
+ */
+void profile_default(cid_profile *p);
+
+/**@brief Read a host profile over the defaults.
+ */
+int profile_load(const char *path, cid_profile *p);
+
+/**@brief Write a host profile.
+ */
+int profile_save(const char *path, const cid_profile *p);
+
+#endif
@@ -0,0 +1,47 @@
+/**@file resample.h
+ *	
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Rational polyphase resampler
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#define CID_CANONICAL_RATE      44100   /**< Internal sampling rate of the demodulator.
+                                        All the filters in use are designed for
+                                        this rate, any other input rate is
+                                        resampled to it. */
+#define RS_TAPS                 24      ///< Taps of the FIR filter per phase
+
+/// Polyphase resampler converting in_rate to out_rate by up/down
+typedef struct {
+	int up;                                 ///< Interpolation factor (L)
+	int down;                               ///< Decimation factor (M)
+	int phase;                              ///< Current phase of the filter (0 to L-1)
+	int idx;                                ///< Next input sample used, relative to the new samples
+	double *coef;                           ///< L phases of RS_TAPS coefficients
+	short hist[RS_TAPS];                    ///< Last RS_TAPS input samples (oldest first)
+	short *work;                            ///< History followed by the new input samples
+	int work_len;                           ///< Size of the work buffer in samples
+} resampler;
+
+/**@brief Create a resampler from in_rate to out_rate.
+ */
+resampler *resampler_new(int in_rate, int out_rate);
+
+/**@brief Max. no. of output samples for nin input samples.
+ */
+int resampler_out_len(resampler *rs, int nin);
+
+/**@brief Resample a block of samples.
+ */
+int resampler_process(resampler *rs, const short *in, int nin, short *out);
+
+/**@brief Free the resampler.
+ */
+void resampler_free(resampler *rs);
+
+#endif
@@ -0,0 +1,84 @@
+/**@file softbit.h
+ *
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Cache of the demodulated signs of the spills, replayed without DSP
+ */
+
+#ifndef SOFTBIT_H
+#define SOFTBIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "fskmodem.h"
+
+#define SOFTBIT_MAGIC           0x54494253U     ///< "SBIT", starts every spill record
+#define SOFTBIT_MAX_RUNS        (1 << 24)       ///< Most runs in a spill record
+
+/// Header of a spill record, followed by the runs coded in nbytes bytes
+struct softbit_spill {
+	uint32_t magic;                 ///< SOFTBIT_MAGIC
+	int32_t line;                   ///< Line of the spill
+	int64_t end_us;                 ///< End of the spill, micro seconds since the Epoch
+	int32_t result;                 ///< Result of the decoder: 1 decoded, -1 failed, 0 cut short
+	int32_t warm;                   ///< fsk_data::warm of the spill
+	int32_t pllispb;                ///< fsk_data::pllispb of the spill
+	int32_t pllids;                 ///< fsk_data::pllids of the spill
+	int32_t pllispb2;               ///< fsk_data::pllispb2 of the spill
+	uint32_t nruns;                 ///< No. of runs
+	uint32_t nbytes;                ///< Size of the coded runs
+};
+
+/// Cache the spills are recorded to
+typedef struct {
+	int fd;                         ///< Cache file, opened to append
+	struct fsk_runs runs;           ///< Signs of the spill being recorded
+	unsigned char *buf;             ///< Record being written
+	size_t max;                     ///< Size of buf
+} softbit_writer;
+
+/// Cache the spills are replayed from
+typedef struct {
+	FILE *fp;                       ///< Cache file
+	struct softbit_spill spill;     ///< Header of the spill read
+	struct fsk_runs runs;           ///< Signs of the spill read
+	unsigned char *buf;             ///< Coded runs of the spill read
+	size_t max;                     ///< Size of buf
+	long long values;               ///< No. of values in the runs
+} softbit_reader;
+
+/**@brief Open a cache to record spills to.
+ */
+softbit_writer *softbit_create(const char *path);
+
+/**@brief Start recording a spill.
+ */
+struct fsk_runs *softbit_start(softbit_writer *w);
+
+/**@brief Write the spill recorded.
+ */
+int softbit_end(softbit_writer *w, const fsk_data *fskd, int line, int result);
+
+/**@brief Close a cache recorded to.
+ */
+void softbit_close(softbit_writer *w);
+
+/**@brief Open a cache to replay.
+ */
+softbit_reader *softbit_open(const char *path);
+
+/**@brief Read the next spill of the cache.
+ */
+int softbit_next(softbit_reader *r);
+
+/**@brief Set up the FSK data of a new spill to replay the spill read.
+ */
+void softbit_seed(softbit_reader *r, fsk_data *fskd);
+
+/**@brief Close a cache replayed.
+ */
+void softbit_free(softbit_reader *r);
+
+#endif
@@ -0,0 +1,102 @@
+/**@file spillarc.h
+ *
+ * @author Jenil Jain
+ * @copyright Copyright 2015 Insensi Inc. All rights reserved.
+ * This project is released under the GNU Public License.
+ *
+ * @brief Compressed archive of the audio of a spill
+ */
+
+#ifndef SPILLARC_H
+#define SPILLARC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cdrstore.h"
+
+#define SPILLARC_MAGIC          0x41444943U     ///< "CIDA", starts an archive
+#define SPILLARC_VERSION        1       ///< Version of the format
+#define SPILLARC_BLOCK          1024    ///< Samples per block
+#define SPILLARC_SQUELCH        32      ///< Blocks with a smaller peak are kept as silence
+#define SPILLARC_MAX_ORDER      3       ///< Highest order of the predictors
+#define SPILLARC_SILENT         0xff    ///< Order of a block kept as silence
+#define SPILLARC_RICE_ESC       24      ///< Rice quotient escaping to a raw value
+#define SPILLARC_RAW_BITS       20      ///< Bits of a raw value, enough for any residual
+#define SPILLARC_MAX_SEC        30      ///< Audio of a spill archived at most
+#define SPILLARC_PATH_LEN       256     ///< Max. length of a path
+
+/// Header of an archive, followed by the blocks, then by the index
+struct spillarc_header {
+	uint32_t magic;                 ///< SPILLARC_MAGIC
+	uint32_t version;               ///< SPILLARC_VERSION
+	int32_t rate;                   ///< Sampling rate of the audio
+	int32_t squelch;                ///< Peak below which a block is silence, 0 if lossless
+	uint32_t block;                 ///< Samples per block
+	uint32_t nblocks;               ///< No. of blocks
+	uint64_t nsamples;              ///< No. of samples, the last block can be shorter
+	int32_t result;                 ///< Result of the decoder: 1 decoded, -1 failed, 0 cut short
+	int32_t engine;                 ///< Demodulation engine of the decoder (FSK_ENGINE_*)
+	struct cdr_record call;         ///< Call record of the spill, as in the call store, zeros if not decoded
+	uint64_t index_off;             ///< Offset of the index, the offsets of the nblocks blocks (uint32_t)
+};
+
+/// Audio of the spill in progress, archived when it ends
+typedef struct {
+	int rate;                       ///< Sampling rate
+	short *s;                       ///< Samples of the spill
+	int len;                        ///< No. of samples
+	int max;                        ///< Size of s, samples past it are dropped
+	unsigned char *out;             ///< Coded archive
+	size_t outmax;                  ///< Size of out
+} spillarc_writer;
+
+/// Archive mapped for reading
+typedef struct {
+	const unsigned char *map;       ///< Mapped file
+	size_t size;                    ///< Size of the file
+	const struct spillarc_header *hdr;      ///< Header
+	const uint32_t *index;          ///< Offsets of the blocks
+	uint32_t blk;                   ///< Next block to decode
+	short cur[SPILLARC_BLOCK];      ///< Block decoded
+	int cur_len;                    ///< Samples in cur
+	int cur_pos;                    ///< Samples of cur already read
+} spillarc_reader;
+
+/**@brief Create the buffer of the spills of a line.
+ */
+spillarc_writer *spillarc_writer_new(int rate, int max_samples);
+
+/**@brief Start a new spill.
+ */
+void spillarc_reset(spillarc_writer *w);
+
+/**@brief Append samples to the spill.
+ */
+void spillarc_put(spillarc_writer *w, const short *s, int n);
+
+/**@brief Code the spill and write it to an archive.
+ */
+int spillarc_save(spillarc_writer *w, const char *path, int squelch, int result, int engine,
+		  const struct cdr_record *call);
+
+/**@brief Free the buffer of the spills.
+ */
+void spillarc_writer_free(spillarc_writer *w);
+
+/**@brief Map an archive.
+ */
+spillarc_reader *spillarc_open(const char *path);
+
+/**@brief Decode the next samples of an archive.
+ */
+int spillarc_read(spillarc_reader *r, short *out, int max);
+
+/**@brief Go to a sample of an archive.
+ */
+int spillarc_seek(spillarc_reader *r, uint64_t sample);
+
+/**@brief Unmap an archive.
+ */
+void spillarc_close(spillarc_reader *r);
+
+#endif
@@ -0,0 +1,159 @@
+/**@file lineparm.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Parameters learned on every line, kept to warm start the next spill
+ *
+ * A line behaves the same call after call: same level, DC offset and baud
+ * error. While the 1s and 0s of the channel seizure alternate, the
+ * demodulator measures them (struct fsk_learn), and the spills decoded are
+ * averaged here into the parameters of the line:			<BR>
+ *      gain    : brings the input to LINEPARM_TARGET_TONE                      <BR>
+ *      dc      : mean of the input                                            <BR>
+ *      pllispb : samples per bit actually seen, in 1/32 sample like the DPLL,  <BR>
+ *                kept nominal unless off by more than LINEPARM_MIN_BAUD_ERR     <BR>
+ * The next spill of the line starts with them instead of the defaults, and
+ * accepts a truncated channel seizure and Mark signal.
+ *
+ * The parameters of all the lines are kept in one file of fixed size
+ * records, indexed by the line, read and written with pread()/pwrite().
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lineparm.h"
+
+/**@brief Read the learned parameters of a line.
+ *
+ * @param path parameter file
+ * @param line line number
+ * @param lp parameters to fill
+ *
+ * @return 0 if the line learned before, -1 if not (lp is cleared)
+ */
+int lineparm_load(const char *path, int line, struct line_params *lp)
+{
+    int fd, res;
+
+    memset(lp, 0, sizeof(*lp));
+    if (line < 0 || line >= LINEPARM_MAX_LINES || (fd = open(path, O_RDONLY)) < 0)
+	return -1;
+
+    res = pread(fd, lp, sizeof(*lp), (off_t) line * sizeof(*lp));
+    close(fd);
+
+    if (res != sizeof(*lp) || lp->magic != LINEPARM_MAGIC) {
+	memset(lp, 0, sizeof(*lp));
+	return -1;
+    }
+    return 0;
+}
+
+/**@brief Write the learned parameters of a line.
+ *
+ * Only the record of the line is written, so every line can be saved by its
+ * own decoder.
+ *
+ * @param path parameter file, created if needed
+ * @param line line number
+ * @param lp parameters to write
+ *
+ * @return 0 if successful else -1 if error
+ */
+int lineparm_save(const char *path, int line, const struct line_params *lp)
+{
+    int fd, res;
+
+    if (line < 0 || line >= LINEPARM_MAX_LINES || (fd = open(path, O_WRONLY | O_CREAT, 0644)) < 0)
+	return -1;
+
+    res = pwrite(fd, lp, sizeof(*lp), (off_t) line * sizeof(*lp));
+    close(fd);
+    return (res == sizeof(*lp)) ? 0 : -1;
+}
+
+/**@brief Seed the FSK data of a new spill with the learned parameters.
+ *
+ * Called after fskmodem_init(), which sets the defaults.
+ *
+ * @param fskd FSK data of the new spill
+ * @param lp parameters of the line
+ */
+void lineparm_seed(fsk_data * fskd, const struct line_params *lp)
+{
+    if (lp->magic != LINEPARM_MAGIC)
+	return;
+
+    fskd->gain = lp->gain;
+    fskd->dc = lp->dc;
+    fskd->pllispb = lp->pllispb;                // DPLL centered on the learned period
+    fskd->pllids = fskd->pllispb / FSK_PLL_GAIN;
+    fskd->pllispb2 = fskd->pllispb / 2;
+    fskd->warm = 1;
+}
+
+/**@brief Clamp a value in a range */
+static int clamp(int v, int lo, int hi)
+{
+    return (v < lo) ? lo : ((v > hi) ? hi : v);
+}
+
+/**@brief Exponential average of a parameter */
+static int average(int old, int val, int first)
+{
+    return first ? val : old + ((val - old) >> LINEPARM_SHIFT);
+}
+
+/**@brief Update the learned parameters with what the spill measured.
+ *
+ * Nothing is learned before the channel seizure is detected, or from a
+ * seizure too short to measure. The measurements are consumed, so calling
+ * it again for the same spill does nothing.
+ *
+ * @param lp parameters of the line
+ * @param fskd FSK data of the spill
+ *
+ * @return 1 if the parameters changed else 0
+ */
+int lineparm_learn(struct line_params *lp, fsk_data * fskd)
+{
+    struct fsk_learn *m = &fskd->learn;
+    int first = (lp->magic != LINEPARM_MAGIC);
+    int nominal = fskd->pllnominal;
+    double mean, rms;
+    int gain, spb;
+
+    if (!m->done || m->nbits < LINEPARM_MIN_BITS) {
+	if (m->done)
+	    memset(m, 0, sizeof(*m));
+	return 0;
+    }
+
+    mean = m->sum / m->nsamp;
+    rms = sqrt(m->tone / m->nsamp);
+    if (rms < 1) {
+	memset(m, 0, sizeof(*m));
+	return 0;
+    }
+
+    gain = clamp(lrint(fskd->gain * LINEPARM_TARGET_TONE / rms), LINEPARM_MIN_GAIN, LINEPARM_MAX_GAIN);
+    spb = clamp(lrint(32.0 * m->nsamp / m->nbits),
+		nominal - nominal * LINEPARM_MAX_BAUD_ERR / 1000,
+		nominal + nominal * LINEPARM_MAX_BAUD_ERR / 1000);
+    if (abs(spb - nominal) <= nominal * LINEPARM_MIN_BAUD_ERR / 1000)
+	spb = nominal;
+
+    lp->gain = average(lp->gain, gain, first);
+    lp->dc = average(lp->dc, lrint(mean), first);
+    lp->pllispb = average(lp->pllispb, spb, first);
+    lp->magic = LINEPARM_MAGIC;
+    lp->spills++;
+
+    memset(m, 0, sizeof(*m));
+    return 1;
+}
@@ -0,0 +1,336 @@
+/**@file numlist.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Memory-mapped block/allow list of numbers and prefixes
+ *
+ * The list is a sorted array of fixed-size entries in a file which is used
+ * directly through mmap(), so loading it costs no parsing. A lookup goes to
+ * the bucket of the top digits, finds the greatest entry not above the
+ * number with a binary search, and then follows the parent links (the
+ * longest prefix entry of every entry, stored at build time) until an entry
+ * matches. A prefix of the number is always on that chain, so at most
+ * NUMLIST_DIGITS links are followed.
+ *
+ * The list is updated by writing a new file and renaming it over the old
+ * one. numlist_refresh() sees the new inode and swaps the mapping.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "numlist.h"
+
+/**@brief Key of a number.
+ *
+ * @param number digits of the number, other characters are skipped
+ * @param kind NUMLIST_PREFIX or NUMLIST_EXACT
+ * @param key pointer to store the key
+ *
+ * @return no. of digits, or -1 if there are none or too many
+ */
+static int numlist_key(const char *number, int kind, uint64_t * key)
+{
+    int n = 0;
+
+    *key = 0;
+    for (; *number; number++) {
+	if (*number < '0' || *number > '9')
+	    continue;
+	if (n == NUMLIST_DIGITS)
+	    return -1;
+	*key |= (uint64_t) (*number - '0' + 1) << (60 - 4 * n);
+	n++;
+    }
+    *key |= kind;
+    return n ? n : -1;
+}
+
+/**@brief Check if the entry matches the number key */
+static int numlist_match(uint64_t entry, uint64_t key)
+{
+    uint64_t mask;
+
+    if ((entry & 0xf) == NUMLIST_EXACT)
+	return entry == key;
+
+    /* Prefix: compare down to the nibble of the last digit of the entry */
+    mask = ~((1ULL << (__builtin_ctzll(entry & ~0xfULL) & ~3)) - 1);
+    return ((entry ^ key) & mask) == 0;
+}
+
+/**@brief Map a list file and check its header */
+static struct numlist_map *numlist_map_file(const char *path)
+{
+    struct numlist_map *m;
+    struct stat sb;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+	return NULL;
+    if (fstat(fd, &sb) == -1 || sb.st_size < (off_t) sizeof(struct numlist_header) ||
+	!(m = calloc(1, sizeof(*m)))) {
+	close(fd);
+	return NULL;
+    }
+
+    m->size = sb.st_size;
+    m->base = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m->base == MAP_FAILED) {
+	free(m);
+	return NULL;
+    }
+
+    m->hdr = m->base;
+    m->e = (const struct numlist_entry *) (m->hdr + 1);
+    m->dev = sb.st_dev;
+    m->ino = sb.st_ino;
+
+    if (m->hdr->magic != NUMLIST_MAGIC || m->hdr->version != NUMLIST_VERSION ||
+	sizeof(struct numlist_header) + m->hdr->count * sizeof(struct numlist_entry) > m->size) {
+	fprintf(stderr, "%s is not a number list\n", path);
+	munmap(m->base, m->size);
+	free(m);
+	return NULL;
+    }
+    return m;
+}
+
+static void numlist_unmap(struct numlist_map *m)
+{
+    if (m) {
+	munmap(m->base, m->size);
+	free(m);
+    }
+}
+
+/**@brief Map a list file.
+ * @param path path of the file written by numlist_build()
+ * @return Returns a pointer to a malloc'd numlist, or NULL on error.
+ */
+numlist *numlist_open(const char *path)
+{
+    numlist *nl;
+
+    if (!(nl = calloc(1, sizeof(*nl))))
+	return NULL;
+    snprintf(nl->path, sizeof(nl->path), "%s", path);
+
+    if (!(nl->cur = numlist_map_file(path))) {
+	free(nl);
+	return NULL;
+    }
+    return nl;
+}
+
+/**@brief Map the list file again if it was replaced.
+ *
+ * The new mapping is published atomically, the previous one is kept until
+ * the next refresh in case a lookup is still using it.
+ *
+ * @param nl pointer to the list
+ * @return 1 if the list was replaced, 0 if not, -1 on error
+ */
+int numlist_refresh(numlist * nl)
+{
+    struct numlist_map *m;
+    struct stat sb;
+
+    if (stat(nl->path, &sb) == -1)
+	return -1;
+    if (sb.st_dev == nl->cur->dev && sb.st_ino == nl->cur->ino)
+	return 0;
+
+    if (!(m = numlist_map_file(nl->path)))
+	return -1;
+
+    numlist_unmap(nl->old);
+    nl->old = nl->cur;
+    __atomic_store_n(&nl->cur, m, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/**@brief Look up a number in the list.
+ *
+ * @param nl pointer to the list
+ * @param number the number as decoded
+ *
+ * @retval NUMLIST_BLOCK or NUMLIST_ALLOW of the exact number or of its longest prefix
+ * @retval NUMLIST_UNKNOWN if nothing matches
+ */
+int numlist_lookup(numlist * nl, const char *number)
+{
+    const struct numlist_map *m = __atomic_load_n(&nl->cur, __ATOMIC_ACQUIRE);
+    uint64_t key;
+    uint32_t lo, hi, mid, i;
+    unsigned int b;
+
+    if (!m || numlist_key(number, NUMLIST_EXACT, &key) < 0)
+	return NUMLIST_UNKNOWN;
+
+    /* Greatest entry <= key, searching from the end of the bucket */
+    b = key >> (64 - NUMLIST_BUCKET_BITS);
+    lo = m->hdr->bucket[b];
+    hi = m->hdr->bucket[b + 1];
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (m->e[mid].key <= key)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == 0)
+	return NUMLIST_UNKNOWN;
+
+    for (i = lo - 1; i != NUMLIST_NONE; i = m->e[i].parent) {
+	if (numlist_match(m->e[i].key, key))
+	    return m->e[i].verdict;
+    }
+    return NUMLIST_UNKNOWN;
+}
+
+/**@brief Unmap and free the list.
+ * @param nl pointer to the list
+ */
+void numlist_close(numlist * nl)
+{
+    if (nl) {
+	numlist_unmap(nl->cur);
+	numlist_unmap(nl->old);
+	free(nl);
+    }
+}
+
+/* Order of the keys, then of the lines of the text file (in parent until
+   the parent links are made), qsort() is not stable */
+static int entry_cmp(const void *a, const void *b)
+{
+    const struct numlist_entry *x = a, *y = b;
+
+    if (x->key != y->key)
+	return (x->key > y->key) - (x->key < y->key);
+    return (x->parent > y->parent) - (x->parent < y->parent);
+}
+
+/**@brief Build a list file from a text file.
+ *
+ * Every line of the text file is a number and a verdict, "block" or
+ * "allow". A number ending with '*' is a prefix. The file is written next
+ * to path and renamed over it, so that lists in use see either the old or
+ * the new file.
+ *
+ * @param txt_path path of the text file
+ * @param path path of the list file
+ *
+ * @return no. of entries, or -1 on error
+ */
+int numlist_build(const char *txt_path, const char *path)
+{
+    FILE *in, *out;
+    char line[128], num[64], verdict[16], tmp[300];
+    struct numlist_entry *e = NULL, *t;
+    struct numlist_header *hdr;
+    uint32_t *stack;
+    size_t n = 0, max = 0, i, j;
+    int sp = 0, kind, len;
+
+    if (!(in = fopen(txt_path, "r")))
+	return -1;
+
+    while (fgets(line, sizeof(line), in)) {
+	if (sscanf(line, "%63s %15s", num, verdict) != 2 || num[0] == '#')
+	    continue;
+	len = strlen(num);
+	kind = (num[len - 1] == '*') ? NUMLIST_PREFIX : NUMLIST_EXACT;
+
+	if (n == max) {
+	    max = max ? 2 * max : 1024;
+	    if (!(t = realloc(e, max * sizeof(*e)))) {
+		free(e);
+		fclose(in);
+		return -1;
+	    }
+	    e = t;
+	}
+	if (numlist_key(num, kind, &e[n].key) < 0) {
+	    fprintf(stderr, "Skipping invalid number %s\n", num);
+	    continue;
+	}
+	e[n].verdict = (strcmp(verdict, "allow") == 0) ? NUMLIST_ALLOW : NUMLIST_BLOCK;
+	e[n].parent = n;                        // Line order, for the duplicates
+	n++;
+    }
+    fclose(in);
+
+    qsort(e, n, sizeof(*e), entry_cmp);
+    for (i = j = 0; i < n; i++) {               // Duplicates, the last line wins
+	if (j && e[j - 1].key == e[i].key)
+	    j--;
+	e[j++] = e[i];
+    }
+    n = j;
+
+    /* Parent links: stack of the prefix entries containing the current one */
+    hdr = calloc(1, sizeof(*hdr));
+    stack = malloc((NUMLIST_DIGITS + 1) * sizeof(*stack));
+    if (!hdr || !stack) {
+	free(hdr);
+	free(stack);
+	free(e);
+	return -1;
+    }
+    for (i = 0; i < n; i++) {
+	while (sp && !numlist_match(e[stack[sp - 1]].key, e[i].key | NUMLIST_EXACT))
+	    sp--;
+	e[i].parent = sp ? stack[sp - 1] : NUMLIST_NONE;
+	if ((e[i].key & 0xf) == NUMLIST_PREFIX)
+	    stack[sp++] = i;
+    }
+
+    /* Buckets of the top key bits */
+    for (i = 0, j = 0; j <= NUMLIST_BUCKETS; j++) {
+	while (i < n && (e[i].key >> (64 - NUMLIST_BUCKET_BITS)) < j)
+	    i++;
+	hdr->bucket[j] = i;
+    }
+    hdr->magic = NUMLIST_MAGIC;
+    hdr->version = NUMLIST_VERSION;
+    hdr->count = n;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((out = fopen(tmp, "wb"))) {
+	if (fwrite(hdr, sizeof(*hdr), 1, out) != 1 || fwrite(e, sizeof(*e), n, out) != n)
+	    n = (size_t) - 1;
+	if (fclose(out) || n == (size_t) - 1 || rename(tmp, path))
+	    n = (size_t) - 1;
+    } else
+	n = (size_t) - 1;
+    if (n == (size_t) - 1)
+	perror("writing number list");
+
+    free(stack);
+    free(hdr);
+    free(e);
+    return (int) n;
+}
+
+/**@brief Name of a verdict.
+ * @param verdict NUMLIST_UNKNOWN, NUMLIST_BLOCK or NUMLIST_ALLOW
+ */
+const char *numlist_verdict_name(int verdict)
+{
+    switch (verdict) {
+    case NUMLIST_BLOCK:
+	return "BLOCK";
+    case NUMLIST_ALLOW:
+	return "ALLOW";
+    default:
+	return "UNKNOWN";
+    }
+}
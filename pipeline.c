@@ -0,0 +1,239 @@
+/**@file pipeline.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Pipeline of the stages a block of the line goes through
+ *
+ * Between the capture (or the wav file) and the sinks of main(), a block of
+ * the line goes through stages listed by a spec, from the host profile or
+ * -G:								<BR>
+ *      tap,gate=64,gain=1.5,resample,decode				<BR>
+ * tap     : archives the block for the spill archive (-A), as captured so
+ *           only as the first stage					<BR>
+ * gate    : drops the blocks with a peak below the argument while the line
+ *           searches for a spill, nothing is demodulated in the silence	<BR>
+ * gain    : multiplies the samples by the argument			<BR>
+ * resample: converts the block to CID_CANONICAL_RATE			<BR>
+ * decode  : demodulates and frames the bytes, callerid_feed(), always last	<BR>
+ * A tap without an archive and a resample at the canonical rate are left
+ * out, so one spec fits every line. PROFILE_PIPELINE is the decoder as it
+ * was before the pipelines.
+ *
+ * The stages share the buffers of the line: the sample stages change the
+ * block in place, resample writes the line's resampled buffer, and decode
+ * reads whichever the last stage left. A run of sample stages is fused: one
+ * loop over the block calls every kernel on a sample before going to the
+ * next, then the ends of block of the stages run (the gate decides there).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+
+/**@brief Archive the block as captured. */
+static int tap_block(struct pipe_node *nd, short **s, int *n)
+{
+    spillarc_put(nd->pl->arcw, *s, *n);
+    return 0;
+}
+
+/**@brief Measure the peak of the block. */
+static int gate_sample(struct pipe_node *nd, int x)
+{
+    int a = (x < 0) ? -x : x;
+
+    if (a > nd->peak)
+	nd->peak = a;
+    return x;
+}
+
+/**@brief Drop a quiet block while the line searches for a spill. */
+static int gate_end(struct pipe_node *nd, short **s, int *n)
+{
+    int quiet = nd->peak < nd->arg;
+
+    nd->peak = 0;
+    if (quiet && fsk_searching(&nd->pl->cs->fskd)) {
+	nd->pl->dropped++;
+	return 1;
+    }
+    return 0;
+}
+
+/**@brief Multiply a sample by the gain, clipped. */
+static int gain_sample(struct pipe_node *nd, int x)
+{
+    double v = x * nd->arg;
+
+    return (v > 32767) ? 32767 : ((v < -32768) ? -32768 : (int) v);
+}
+
+/**@brief Resample the block to CID_CANONICAL_RATE. */
+static int resample_block(struct pipe_node *nd, short **s, int *n)
+{
+    *n = resampler_process(nd->pl->rs, *s, *n, nd->pl->rs_buf);
+    *s = nd->pl->rs_buf;
+    return 0;
+}
+
+/**@brief Demodulate the block and frame the bytes. */
+static int decode_block(struct pipe_node *nd, short **s, int *n)
+{
+    nd->pl->res = callerid_feed(nd->pl->cs, (unsigned char *) *s, *n * 2);
+    return 1;
+}
+
+/// Stages a spec can list
+static const struct {
+    const char *name;
+    pipe_sample_fn sample;
+    pipe_block_fn block;
+    double arg;                                 // Default argument
+} stages[] = {
+    { "tap", NULL, tap_block, 0 },
+    { "gate", gate_sample, gate_end, PIPE_GATE_PEAK },
+    { "gain", gain_sample, NULL, 1 },
+    { "resample", NULL, resample_block, 0 },
+    { "decode", NULL, decode_block, 0 },
+};
+
+/**@brief Build the pipeline of a line from its spec.
+ *
+ * @param pl pipeline to build
+ * @param spec stages separated by ',', "name" or "name=arg"
+ * @param cs decoder of the line
+ * @param rs resampler of the line, NULL if the line is at CID_CANONICAL_RATE
+ * @param rs_buf resampled samples of the line
+ * @param arcw audio of the spill, NULL if not archived
+ *
+ * @return 0 if successful else -1 if the spec is invalid
+ */
+int pipeline_init(pipeline * pl, const char *spec, struct callerid_state *cs, resampler * rs,
+		  short *rs_buf, spillarc_writer * arcw)
+{
+    char buf[PROFILE_PIPELINE_LEN], *tok, *save, *eq;
+    struct pipe_node *nd;
+    int i, resampled = 0, listed = 0;
+
+    memset(pl, 0, sizeof(*pl));
+    pl->cs = cs;
+    pl->rs = rs;
+    pl->rs_buf = rs_buf;
+    pl->arcw = arcw;
+
+    if (snprintf(buf, sizeof(buf), "%s", spec) >= (int) sizeof(buf)) {
+	fprintf(stderr, "Pipeline %s: too long\n", spec);
+	return -1;
+    }
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+	if ((eq = strchr(tok, '=')))
+	    *eq++ = '\0';
+	for (i = 0; i < (int) (sizeof(stages) / sizeof(stages[0])); i++)
+	    if (strcmp(tok, stages[i].name) == 0)
+		break;
+	if (i == (int) (sizeof(stages) / sizeof(stages[0]))) {
+	    fprintf(stderr, "Pipeline %s: unknown stage %s\n", spec, tok);
+	    return -1;
+	}
+	if (pl->n && pl->node[pl->n - 1].block == decode_block) {
+	    fprintf(stderr, "Pipeline %s: decode must be the last stage\n", spec);
+	    return -1;
+	}
+	if (stages[i].block == tap_block && listed) {  // The audio is changed or dropped
+	    fprintf(stderr, "Pipeline %s: tap must be the first stage\n", spec);
+	    return -1;
+	}
+	listed++;
+	if (stages[i].block == resample_block)
+	    resampled = 1;
+	if ((stages[i].block == tap_block && !arcw) || (stages[i].block == resample_block && !rs))
+	    continue;                           // Nothing to do on this line
+	if (pl->n == PIPE_MAX_NODES) {
+	    fprintf(stderr, "Pipeline %s: more than %d stages\n", spec, PIPE_MAX_NODES);
+	    return -1;
+	}
+
+	nd = &pl->node[pl->n++];
+	nd->name = stages[i].name;
+	nd->sample = stages[i].sample;
+	nd->block = stages[i].block;
+	nd->arg = eq ? atof(eq) : stages[i].arg;
+	nd->pl = pl;
+    }
+    if (!pl->n || pl->node[pl->n - 1].block != decode_block) {
+	fprintf(stderr, "Pipeline %s: no decode stage\n", spec);
+	return -1;
+    }
+    if (rs && !resampled) {
+	fprintf(stderr, "Pipeline %s: the line needs resample\n", spec);
+	return -1;
+    }
+
+    for (i = 0; i < pl->n; i++)                 // Runs of sample stages are fused
+	if (!i || !pl->node[i].sample || !pl->node[i - 1].sample)
+	    pl->group[pl->ngroups++] = i;
+    pl->group[pl->ngroups] = pl->n;
+    return 0;
+}
+
+/**@brief Run a block of the line through the pipeline.
+ *
+ * @param pl pipeline of the line
+ * @param s samples, changed in place by the sample stages
+ * @param n no. of samples
+ *
+ * @return same as callerid_feed(), 0 if the block was dropped
+ */
+int pipeline_run(pipeline * pl, short *s, int n)
+{
+    struct pipe_node *nd, *first, *end;
+    int g, i, x;
+
+    pl->res = 0;
+    pl->blocks++;
+    for (g = 0; g < pl->ngroups; g++) {
+	first = &pl->node[pl->group[g]];
+	end = &pl->node[pl->group[g + 1]];
+
+	if (first->sample) {                    // One loop for the group
+	    for (i = 0; i < n; i++) {
+		x = s[i];
+		for (nd = first; nd < end; nd++)
+		    x = nd->sample(nd, x);
+		s[i] = x;
+	    }
+	}
+	for (nd = first; nd < end; nd++)
+	    if (nd->block && nd->block(nd, &s, &n))
+		return pl->res;
+    }
+    return pl->res;
+}
+
+/**@brief Print the stages and the groups run fused.
+ *
+ * @param pl pipeline
+ * @param fp stream to print to
+ */
+void pipeline_report(const pipeline * pl, FILE * fp)
+{
+    const struct pipe_node *nd;
+    int g;
+
+    fprintf(fp, "Pipeline:");
+    for (g = 0; g < pl->ngroups; g++) {
+	fprintf(fp, "%s", g ? " ->" : "");
+	for (nd = &pl->node[pl->group[g]]; nd < &pl->node[pl->group[g + 1]]; nd++) {
+	    fprintf(fp, " %s", nd->name);
+	    if (nd->sample)
+		fprintf(fp, "=%g", nd->arg);
+	}
+	if (pl->group[g + 1] - pl->group[g] > 1)
+	    fprintf(fp, " (fused)");
+    }
+    if (pl->blocks)
+	fprintf(fp, ", %llu blocks, %llu dropped by the gate", pl->blocks, pl->dropped);
+    fprintf(fp, "\n");
+}
@@ -0,0 +1,115 @@
+/**@file profile.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Host profile with the decoder configuration tuned for the machine
+ *
+ * The profile is a text file of "key value" lines, '#' starts a comment:	<BR>
+ *      period_size 256                                                         <BR>
+ *      period_count 4                                                          <BR>
+ *      engine iir_sp                                                           <BR>
+ *      ns_per_sample 41.3                                                      <BR>
+ *      pipeline tap,gate=64,resample,decode                                    <BR>
+ * It is written by cid_tune and read by cid_fsk when the lines are created.
+ * Unknown keys are ignored, and values that this build can not use (an
+ * engine that is not built in, a period out of range) keep the default, so
+ * a profile from a newer build never stops the decoder.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fskmodem.h"
+#include "profile.h"
+
+/**@brief Default configuration, used when there is no profile.
+ *
+ * @param p profile to fill
+ */
+void profile_default(cid_profile * p)
+{
+    p->period_size = PROFILE_PERIOD_SIZE;
+    p->period_count = PROFILE_PERIOD_COUNT;
+    p->engine = FSK_ENGINE_IIR_SP;
+    p->ns_per_sample = 0;
+    strcpy(p->pipeline, PROFILE_PIPELINE);
+}
+
+/**@brief Read a host profile over the defaults.
+ *
+ * @param path profile file
+ * @param p profile, only the keys present in the file are changed
+ *
+ * @return 0 if successful else -1 if the file can't be read
+ */
+int profile_load(const char *path, cid_profile * p)
+{
+    FILE *fp;
+    char line[128], key[32], val[64];
+    int n;
+
+    if (!(fp = fopen(path, "r")))
+	return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+	if (line[0] == '#' || sscanf(line, "%31s %63s", key, val) != 2)
+	    continue;
+
+	if (strcmp(key, "period_size") == 0) {
+	    n = atoi(val);
+	    if (n >= PROFILE_MIN_PERIOD && n <= PROFILE_MAX_PERIOD)
+		p->period_size = n;
+	    else
+		fprintf(stderr, "%s: period_size %s out of range\n", path, val);
+	} else if (strcmp(key, "period_count") == 0) {
+	    n = atoi(val);
+	    if (n >= 2 && n <= 16)
+		p->period_count = n;
+	} else if (strcmp(key, "engine") == 0) {
+	    if ((n = fsk_engine_lookup(val)) >= 0)
+		p->engine = n;
+	    else
+		fprintf(stderr, "%s: engine %s is not built in\n", path, val);
+	} else if (strcmp(key, "ns_per_sample") == 0)
+	    p->ns_per_sample = atof(val);
+	else if (strcmp(key, "pipeline") == 0)
+	    snprintf(p->pipeline, sizeof(p->pipeline), "%s", val);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/**@brief Write a host profile.
+ *
+ * The file is written next to its final name and renamed, so a decoder
+ * starting at the same time reads either the old or the new profile.
+ *
+ * @param path profile file
+ * @param p profile to write
+ *
+ * @return 0 if successful else -1 if error
+ */
+int profile_save(const char *path, const cid_profile * p)
+{
+    FILE *fp;
+    char tmp[256];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(fp = fopen(tmp, "w")))
+	return -1;
+
+    fprintf(fp, "# Written by cid_tune, fastest configuration passing the accuracy check\n");
+    fprintf(fp, "period_size %d\n", p->period_size);
+    fprintf(fp, "period_count %d\n", p->period_count);
+    fprintf(fp, "engine %s\n", fsk_engine_name(p->engine));
+    fprintf(fp, "ns_per_sample %.1f\n", p->ns_per_sample);
+    fprintf(fp, "pipeline %s\n", p->pipeline);
+
+    if (fclose(fp) || rename(tmp, path)) {
+	remove(tmp);
+	return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**@file resample.c
+ *	
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Rational polyphase resampler
+ *
+ * Converts the captured samples to CID_CANONICAL_RATE, so that one set of
+ * filter coefficients and one DPLL tuning is enough for every input rate.
+ * The rate is changed by L/M, where L and M are the rates divided by their
+ * GCD. The low pass filter is a windowed sinc designed at L times the input
+ * rate and split into L phases, so that only the RS_TAPS coefficients of
+ * the phase of every output sample are computed.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "resample.h"
+
+static int gcd(int a, int b)
+{
+    while (b) {
+	int t = a % b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+/**@brief Create a resampler from in_rate to out_rate.
+ *
+ * The prototype filter has L * RS_TAPS coefficients with the cut-off at
+ * 0.45 of the lower of the two rates (Blackman window). Phase p holds the
+ * coefficients p, p + L, p + 2L, ... so that output samples are a dot
+ * product of RS_TAPS input samples.
+ *
+ * @param in_rate sampling rate of the input samples
+ * @param out_rate sampling rate of the output samples
+ * @return Returns a pointer to a malloc'd resampler, or NULL on error.
+ */
+resampler *resampler_new(int in_rate, int out_rate)
+{
+    resampler *rs;
+    int g, n, ntaps, p, j;
+    double fc, x, w, sum;
+
+    if (in_rate <= 0 || out_rate <= 0)
+	return NULL;
+    if (!(rs = calloc(1, sizeof(*rs))))
+	return NULL;
+
+    g = gcd(in_rate, out_rate);
+    rs->up = out_rate / g;
+    rs->down = in_rate / g;
+    ntaps = rs->up * RS_TAPS;
+
+    if (!(rs->coef = malloc(ntaps * sizeof(double)))) {
+	free(rs);
+	return NULL;
+    }
+
+    /* Cut-off relative to the upsampled rate */
+    fc = 0.45 * ((in_rate < out_rate) ? in_rate : out_rate) / ((double) in_rate * rs->up);
+
+    for (p = 0; p < rs->up; p++) {
+	for (j = 0; j < RS_TAPS; j++) {
+	    n = p + j * rs->up;
+	    x = n - (ntaps - 1) / 2.0;
+	    w = 0.42 - 0.5 * cos(2 * M_PI * n / (ntaps - 1)) + 0.08 * cos(4 * M_PI * n / (ntaps - 1));
+	    rs->coef[p * RS_TAPS + j] = (x == 0) ? 2 * fc * w : w * sin(2 * M_PI * fc * x) / (M_PI * x);
+	}
+    }
+
+    /* Every phase has unity gain at DC */
+    for (p = 0; p < rs->up; p++) {
+	for (j = 0, sum = 0; j < RS_TAPS; j++)
+	    sum += rs->coef[p * RS_TAPS + j];
+	for (j = 0; j < RS_TAPS; j++)
+	    rs->coef[p * RS_TAPS + j] /= sum;
+    }
+    return rs;
+}
+
+/**@brief Max. no. of output samples for nin input samples.
+ * @param rs pointer to the resampler
+ * @param nin no. of input samples
+ */
+int resampler_out_len(resampler * rs, int nin)
+{
+    return (int) (((long long) nin * rs->up) / rs->down) + 2;
+}
+
+/**@brief Resample a block of samples.
+ *
+ * The input samples are appended to the history of the previous block. For
+ * every output sample, the phase is advanced by M and the input position
+ * by the whole number of L contained in it.
+ *
+ * @param rs pointer to the resampler
+ * @param in input samples
+ * @param nin no. of input samples
+ * @param out output buffer of at least resampler_out_len() samples
+ *
+ * @return no. of output samples, or -1 on error
+ */
+int resampler_process(resampler * rs, const short *in, int nin, short *out)
+{
+    int nout = 0;
+    int j, i;
+    double acc;
+    const double *h;
+    short *x;
+
+    if (rs->work_len < RS_TAPS + nin) {
+	free(rs->work);
+	if (!(rs->work = malloc((RS_TAPS + nin) * sizeof(short)))) {
+	    rs->work_len = 0;
+	    return -1;
+	}
+	rs->work_len = RS_TAPS + nin;
+    }
+    memcpy(rs->work, rs->hist, RS_TAPS * sizeof(short));
+    memcpy(rs->work + RS_TAPS, in, nin * sizeof(short));
+
+    while (rs->idx < nin) {
+	x = rs->work + RS_TAPS + rs->idx;               // Newest input sample in use
+	h = rs->coef + rs->phase * RS_TAPS;
+
+	for (j = 0, acc = 0; j < RS_TAPS; j++)
+	    acc += h[j] * x[-j];
+
+	i = (int) lrint(acc);
+	out[nout++] = (i > 32767) ? 32767 : ((i < -32768) ? -32768 : i);
+
+	rs->phase += rs->down;                          // Next output sample
+	rs->idx += rs->phase / rs->up;
+	rs->phase %= rs->up;
+    }
+
+    rs->idx -= nin;
+    memcpy(rs->hist, rs->work + nin, RS_TAPS * sizeof(short));
+    return nout;
+}
+
+/**@brief Free the resampler.
+ * @param rs pointer to the resampler
+ */
+void resampler_free(resampler * rs)
+{
+    if (rs) {
+	free(rs->coef);
+	free(rs->work);
+	free(rs);
+    }
+}
@@ -0,0 +1,248 @@
+/**@file softbit.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Cache of the demodulated signs of the spills, replayed without DSP
+ *
+ * The slicer (get_bit_raw(), the start bit search) only looks at the sign of
+ * the demodulated values: negative for Mark, else Space. While a spill is
+ * decoded, the sign of every value is recorded in the order the slicer got
+ * it (struct fsk_runs), re-demodulated samples included, so the replay
+ * frames exactly the same bits. The signs change a few times per bit, so
+ * they are kept as the lengths of the runs of the same sign, Space first,
+ * each coded in 7 bit groups, low first, the high bit set on all but the
+ * last (1 byte for the runs shorter than 128 values).
+ *
+ * The cache is a sequence of records, one per spill:			<BR>
+ *      struct softbit_spill | coded runs (nbytes)			<BR>
+ * appended with a single write(), so the shards of cid_super can record to
+ * the same file. The DPLL parameters of the spill are kept in the header,
+ * since a warm started line slices with the learned ones.
+ *
+ * A replayed spill is decoded by FSK_ENGINE_SOFTBIT, which returns the
+ * recorded signs instead of filtering the samples fed, so only the framing
+ * and the parser run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "softbit.h"
+
+/**@brief Make a buffer big enough.
+ *
+ * @param buf buffer, reallocated if needed
+ * @param max size of the buffer
+ * @param len size needed
+ *
+ * @return 0 if successful else -1 if out of memory
+ */
+static int reserve(unsigned char **buf, size_t *max, size_t len)
+{
+    unsigned char *p;
+
+    if (len <= *max)
+	return 0;
+    if (!(p = realloc(*buf, len)))
+	return -1;
+    *buf = p;
+    *max = len;
+    return 0;
+}
+
+/**@brief Open a cache to record spills to.
+ *
+ * @param path cache file, created if needed, the spills are appended
+ *
+ * @return Returns a pointer to a malloc'd softbit_writer, or NULL on error.
+ */
+softbit_writer *softbit_create(const char *path)
+{
+    softbit_writer *w;
+
+    if (!(w = calloc(1, sizeof(*w))))
+	return NULL;
+    if ((w->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+	free(w);
+	return NULL;
+    }
+    return w;
+}
+
+/**@brief Start recording a spill.
+ *
+ * @param w cache
+ *
+ * @return signs to record, for fsk_data::runs of the new spill
+ */
+struct fsk_runs *softbit_start(softbit_writer * w)
+{
+    w->runs.n = 0;
+    w->runs.pos = 0;
+    w->runs.used = 0;
+    return &w->runs;
+}
+
+/**@brief Write the spill recorded.
+ *
+ * Nothing is written when nothing was demodulated.
+ *
+ * @param w cache
+ * @param fskd FSK data of the spill
+ * @param line line of the spill
+ * @param result result of the decoder
+ *
+ * @return 0 if successful else -1 if error
+ */
+int softbit_end(softbit_writer * w, const fsk_data * fskd, int line, int result)
+{
+    struct softbit_spill h;
+    struct timeval now;
+    unsigned char *p;
+    unsigned int v;
+    int i;
+
+    if (!w->runs.n)
+	return 0;
+    if (reserve(&w->buf, &w->max, sizeof(h) + 3 * (size_t) w->runs.n))
+	return -1;
+
+    p = w->buf + sizeof(h);
+    for (i = 0; i < w->runs.n; i++) {
+	for (v = w->runs.run[i]; v >= 0x80; v >>= 7)
+	    *p++ = v | 0x80;
+	*p++ = v;
+    }
+
+    gettimeofday(&now, NULL);
+    memset(&h, 0, sizeof(h));
+    h.magic = SOFTBIT_MAGIC;
+    h.line = line;
+    h.end_us = now.tv_sec * 1000000LL + now.tv_usec;
+    h.result = result;
+    h.warm = fskd->warm;
+    h.pllispb = fskd->pllispb;
+    h.pllids = fskd->pllids;
+    h.pllispb2 = fskd->pllispb2;
+    h.nruns = w->runs.n;
+    h.nbytes = p - w->buf - sizeof(h);
+    memcpy(w->buf, &h, sizeof(h));
+
+    w->runs.n = 0;
+    return (write(w->fd, w->buf, p - w->buf) == p - w->buf) ? 0 : -1;
+}
+
+/**@brief Close a cache recorded to.
+ *
+ * @param w cache
+ */
+void softbit_close(softbit_writer * w)
+{
+    if (w) {
+	close(w->fd);
+	free(w->runs.run);
+	free(w->buf);
+	free(w);
+    }
+}
+
+/**@brief Open a cache to replay.
+ *
+ * @param path cache file
+ *
+ * @return Returns a pointer to a malloc'd softbit_reader, or NULL on error.
+ */
+softbit_reader *softbit_open(const char *path)
+{
+    softbit_reader *r;
+
+    if (!(r = calloc(1, sizeof(*r))))
+	return NULL;
+    if (!(r->fp = fopen(path, "rb"))) {
+	free(r);
+	return NULL;
+    }
+    return r;
+}
+
+/**@brief Read the next spill of the cache.
+ *
+ * @param r cache
+ *
+ * @return 1 if a spill was read, 0 at the end of the cache, -1 if the cache
+ * is corrupt
+ */
+int softbit_next(softbit_reader * r)
+{
+    struct softbit_spill *h = &r->spill;
+    unsigned short *run;
+    unsigned char *p, *end;
+    unsigned int v, shift;
+    int i;
+
+    if (fread(h, sizeof(*h), 1, r->fp) != 1)
+	return 0;
+    if (h->magic != SOFTBIT_MAGIC || h->nruns > SOFTBIT_MAX_RUNS || h->nbytes > 3 * h->nruns ||
+	reserve(&r->buf, &r->max, h->nbytes) || fread(r->buf, 1, h->nbytes, r->fp) != h->nbytes)
+	return -1;
+
+    if ((int) h->nruns > r->runs.max) {
+	if (!(run = realloc(r->runs.run, h->nruns * sizeof(*run))))
+	    return -1;
+	r->runs.run = run;
+	r->runs.max = h->nruns;
+    }
+
+    p = r->buf;
+    end = r->buf + h->nbytes;
+    r->values = 0;
+    for (i = 0; i < (int) h->nruns; i++) {
+	for (v = 0, shift = 0; p < end && (*p & 0x80); shift += 7)
+	    v |= (*p++ & 0x7f) << shift;
+	if (p == end || shift > 14)
+	    return -1;
+	v |= *p++ << shift;
+	r->runs.run[i] = v;
+	r->values += v;
+    }
+    r->runs.n = h->nruns;
+    r->runs.pos = 0;
+    r->runs.used = 0;
+    return 1;
+}
+
+/**@brief Set up the FSK data of a new spill to replay the spill read.
+ *
+ * Call after callerid_init(), it switches the line to FSK_ENGINE_SOFTBIT
+ * and slices with the DPLL parameters of the recorded spill.
+ *
+ * @param r cache
+ * @param fskd FSK data of the new spill
+ */
+void softbit_seed(softbit_reader * r, fsk_data * fskd)
+{
+    fskd->engine = FSK_ENGINE_SOFTBIT;
+    fskd->runs = &r->runs;
+    fskd->warm = r->spill.warm;
+    fskd->pllispb = r->spill.pllispb;
+    fskd->pllids = r->spill.pllids;
+    fskd->pllispb2 = r->spill.pllispb2;
+}
+
+/**@brief Close a cache replayed.
+ *
+ * @param r cache
+ */
+void softbit_free(softbit_reader * r)
+{
+    if (r) {
+	fclose(r->fp);
+	free(r->runs.run);
+	free(r->buf);
+	free(r);
+    }
+}
@@ -0,0 +1,449 @@
+/**@file spillarc.c
+ *
+ * @author Jenil Jain
+ * This project is released under the GNU Public License.
+ *
+ * @brief Compressed archive of the audio of a spill
+ *
+ * The audio of every spill is kept for the disputes, at the captured rate.
+ * An FSK tone is a slow sine at 44.1 kHz, so a sample is well predicted by
+ * the previous ones, and only the small residual is coded:		<BR>
+ *      order 0 : x[i]							<BR>
+ *      order 1 : x[i] - x[i-1]						<BR>
+ *      order 2 : x[i] - 2 x[i-1] + x[i-2]				<BR>
+ *      order 3 : x[i] - 3 x[i-1] + 3 x[i-2] - x[i-3]			<BR>
+ * Every block of SPILLARC_BLOCK samples takes the order with the smallest
+ * residuals, and codes them with a Rice code of parameter k: the quotient
+ * by 2^k in unary, then the k low bits. The first samples of a block are
+ * kept as they are, so that a block is decoded without the previous one.
+ * A block quieter than the squelch (the line between the rings) is only
+ * marked as silence, and replayed as zeros: the archive is lossless only
+ * with a squelch of 0. The squelch is applied when the spill is saved, the
+ * buffer keeps the audio as captured.
+ *
+ * The archive is one file per spill:					<BR>
+ *      struct spillarc_header | blocks | index			<BR>
+ * A block is its order (SPILLARC_SILENT for silence), k, then the bits of
+ * the first samples and of the residuals, padded to a byte. The header
+ * carries the result of the decoder and the call record of the spill (the
+ * one indexed by the call store), the index the offset of every block, to
+ * seek without decoding. The reader maps the file, and decodes the blocks
+ * straight into the samples fed to the decoder.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spillarc.h"
+
+/// Bits written MSB first
+struct bit_writer {
+	unsigned char *p;               ///< Next byte
+	uint64_t acc;                   ///< Bits not written yet
+	int n;                          ///< No. of bits in acc
+};
+
+/// Bits read MSB first
+struct bit_reader {
+	const unsigned char *p;         ///< Next byte
+	const unsigned char *end;       ///< End of the block, zeros are read past it
+	uint64_t acc;                   ///< Bits not read yet
+	int n;                          ///< No. of bits in acc
+};
+
+/**@brief Write up to 32 bits */
+static void put_bits(struct bit_writer *bw, uint32_t v, int bits)
+{
+    bw->acc = (bw->acc << bits) | (v & ((1ULL << bits) - 1));
+    bw->n += bits;
+    while (bw->n >= 8) {
+	bw->n -= 8;
+	*bw->p++ = bw->acc >> bw->n;
+    }
+}
+
+/**@brief Write the bits left, padded to a byte */
+static void flush_bits(struct bit_writer *bw)
+{
+    if (bw->n)
+	put_bits(bw, 0, 8 - bw->n);
+}
+
+/**@brief Read up to 32 bits */
+static uint32_t get_bits(struct bit_reader *br, int bits)
+{
+    while (br->n < bits) {
+	br->acc = (br->acc << 8) | ((br->p < br->end) ? *br->p : 0);
+	br->p++;
+	br->n += 8;
+    }
+    br->n -= bits;
+    return (br->acc >> br->n) & ((1ULL << bits) - 1);
+}
+
+/**@brief Write a residual with the Rice code of parameter k */
+static void put_rice(struct bit_writer *bw, int v, int k)
+{
+    uint32_t u = (v < 0) ? ((uint32_t) -v << 1) - 1 : (uint32_t) v << 1;   // Zigzag
+    uint32_t q = u >> k;
+
+    if (q >= SPILLARC_RICE_ESC) {
+	put_bits(bw, (1U << SPILLARC_RICE_ESC) - 1, SPILLARC_RICE_ESC);
+	put_bits(bw, u, SPILLARC_RAW_BITS);
+	return;
+    }
+    put_bits(bw, ((1U << q) - 1) << 1, q + 1);  // q ones and a zero
+    if (k)
+	put_bits(bw, u, k);
+}
+
+/**@brief Read a residual coded with the Rice code of parameter k */
+static int get_rice(struct bit_reader *br, int k)
+{
+    uint32_t q = 0, u;
+
+    while (q < SPILLARC_RICE_ESC && get_bits(br, 1))
+	q++;
+    if (q == SPILLARC_RICE_ESC)
+	u = get_bits(br, SPILLARC_RAW_BITS);
+    else
+	u = (q << k) | (k ? get_bits(br, k) : 0);
+    return (u & 1) ? -(int) ((u + 1) >> 1) : (int) (u >> 1);
+}
+
+/**@brief Prediction of a sample from the previous ones */
+static inline int predict(const short *x, int i, int order)
+{
+    switch (order) {
+    case 1:
+	return x[i - 1];
+    case 2:
+	return 2 * x[i - 1] - x[i - 2];
+    case 3:
+	return 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+    }
+    return 0;
+}
+
+/**@brief Code a block.
+ *
+ * @param x samples of the block
+ * @param n no. of samples
+ * @param squelch peak below which the block is silence
+ * @param out coded block, n * 6 + 16 bytes at most
+ *
+ * @return size of the coded block
+ */
+static size_t encode_block(const short *x, int n, int squelch, unsigned char *out)
+{
+    struct bit_writer bw = { out + 2, 0, 0 };
+    uint64_t sum, best_sum = UINT64_MAX;
+    int i, o, peak = 0, order = 0, k = 0, r;
+
+    for (i = 0; i < n; i++)
+	if (abs(x[i]) > peak)
+	    peak = abs(x[i]);
+    if (peak < squelch) {
+	out[0] = SPILLARC_SILENT;
+	return 1;
+    }
+
+    for (o = 0; o <= SPILLARC_MAX_ORDER && o < n; o++) {
+	for (i = o, sum = 0; i < n; i++)
+	    sum += abs(x[i] - predict(x, i, o));
+	if (sum < best_sum) {
+	    best_sum = sum;
+	    order = o;
+	}
+    }
+    if (order < n)                              // 2^k near the mean of the residuals
+	while (k < SPILLARC_RAW_BITS - 1 && ((uint64_t) (n - order) << (k + 1)) <= 2 * best_sum)
+	    k++;
+
+    out[0] = order;
+    out[1] = k;
+    for (i = 0; i < order; i++)
+	put_bits(&bw, (uint16_t) x[i], 16);
+    for (; i < n; i++) {
+	r = x[i] - predict(x, i, order);
+	put_rice(&bw, r, k);
+    }
+    flush_bits(&bw);
+    return bw.p - out;
+}
+
+/**@brief Decode a block.
+ *
+ * @param in coded block
+ * @param end end of the coded block
+ * @param n no. of samples
+ * @param x samples decoded
+ *
+ * @return 0 if successful else -1 if the block is corrupt
+ */
+static int decode_block(const unsigned char *in, const unsigned char *end, int n, short *x)
+{
+    struct bit_reader br = { in + 2, end, 0, 0 };
+    int i, order, k;
+
+    if (in >= end)
+	return -1;
+    order = in[0];
+    if (order == SPILLARC_SILENT) {
+	memset(x, 0, n * sizeof(*x));
+	return 0;
+    }
+    k = in[1];
+    if (in + 2 > end || order > SPILLARC_MAX_ORDER || k >= SPILLARC_RAW_BITS)
+	return -1;
+
+    for (i = 0; i < order && i < n; i++)
+	x[i] = get_bits(&br, 16);
+    for (; i < n; i++)
+	x[i] = predict(x, i, order) + get_rice(&br, k);
+    return 0;
+}
+
+/**@brief Create the buffer of the spills of a line.
+ *
+ * @param rate sampling rate of the line
+ * @param max_samples samples of a spill archived at most
+ *
+ * @return Returns a pointer to a malloc'd spillarc_writer, or NULL on error.
+ */
+spillarc_writer *spillarc_writer_new(int rate, int max_samples)
+{
+    spillarc_writer *w;
+
+    if (rate <= 0 || max_samples <= 0 || !(w = calloc(1, sizeof(*w))))
+	return NULL;
+    if (!(w->s = malloc(max_samples * sizeof(*w->s)))) {
+	free(w);
+	return NULL;
+    }
+    w->rate = rate;
+    w->max = max_samples;
+    return w;
+}
+
+/**@brief Start a new spill.
+ *
+ * @param w buffer of the spills
+ */
+void spillarc_reset(spillarc_writer * w)
+{
+    w->len = 0;
+}
+
+/**@brief Append samples to the spill.
+ *
+ * @param w buffer of the spills
+ * @param s samples
+ * @param n no. of samples
+ */
+void spillarc_put(spillarc_writer * w, const short *s, int n)
+{
+    if (n > w->max - w->len)
+	n = w->max - w->len;
+    memcpy(w->s + w->len, s, n * sizeof(*s));
+    w->len += n;
+}
+
+/**@brief Code the spill and write it to an archive.
+ *
+ * Nothing is written when the spill has no audio.
+ *
+ * @param w buffer of the spills
+ * @param path archive, replaced if present
+ * @param squelch peak below which a block is silence, 0 to keep all of them
+ * @param result result of the decoder
+ * @param engine demodulation engine of the decoder
+ * @param call call record of the spill, NULL if not decoded
+ *
+ * @return 0 if successful else -1 if error
+ */
+int spillarc_save(spillarc_writer * w, const char *path, int squelch, int result, int engine,
+		  const struct cdr_record *call)
+{
+    struct spillarc_header h;
+    uint32_t *index;
+    size_t size, off;
+    unsigned char *p;
+    uint32_t b;
+    int fd, n, res;
+
+    if (!w->len)
+	return 0;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = SPILLARC_MAGIC;
+    h.version = SPILLARC_VERSION;
+    h.rate = w->rate;
+    h.squelch = squelch;
+    h.block = SPILLARC_BLOCK;
+    h.nblocks = (w->len + SPILLARC_BLOCK - 1) / SPILLARC_BLOCK;
+    h.nsamples = w->len;
+    h.result = result;
+    h.engine = engine;
+    if (call)
+	h.call = *call;
+
+    size = sizeof(h) + h.nblocks * ((size_t) SPILLARC_BLOCK * 6 + 16 + sizeof(*index));
+    if (size > w->outmax) {
+	if (!(p = realloc(w->out, size)))
+	    return -1;
+	w->out = p;
+	w->outmax = size;
+    }
+
+    /* The index is built at the end of the buffer, then moved after the
+       blocks */
+    index = (uint32_t *) (w->out + w->outmax - h.nblocks * sizeof(*index));
+    off = sizeof(h);
+    for (b = 0; b < h.nblocks; b++) {
+	n = (w->len - b * SPILLARC_BLOCK < SPILLARC_BLOCK) ? w->len - b * SPILLARC_BLOCK : SPILLARC_BLOCK;
+	index[b] = off;
+	off += encode_block(w->s + b * SPILLARC_BLOCK, n, squelch, w->out + off);
+    }
+    off = (off + sizeof(*index) - 1) & ~(sizeof(*index) - 1);
+    h.index_off = off;
+    memmove(w->out + off, index, h.nblocks * sizeof(*index));
+    off += h.nblocks * sizeof(*index);
+    memcpy(w->out, &h, sizeof(h));
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	return -1;
+    res = write(fd, w->out, off);
+    close(fd);
+    return (res == (int) off) ? 0 : -1;
+}
+
+/**@brief Free the buffer of the spills.
+ *
+ * @param w buffer of the spills
+ */
+void spillarc_writer_free(spillarc_writer * w)
+{
+    if (w) {
+	free(w->s);
+	free(w->out);
+	free(w);
+    }
+}
+
+/**@brief Map an archive.
+ *
+ * @param path archive
+ *
+ * @return Returns a pointer to a malloc'd spillarc_reader, or NULL if the
+ * file is not an archive.
+ */
+spillarc_reader *spillarc_open(const char *path)
+{
+    spillarc_reader *r;
+    const struct spillarc_header *h;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return NULL;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(*h) || !(r = calloc(1, sizeof(*r)))) {
+	close(fd);
+	return NULL;
+    }
+    r->size = st.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+	free(r);
+	return NULL;
+    }
+    madvise((void *) r->map, r->size, MADV_SEQUENTIAL);
+
+    h = r->hdr = (const struct spillarc_header *) r->map;
+    if (h->magic != SPILLARC_MAGIC || h->version != SPILLARC_VERSION ||
+	h->block != SPILLARC_BLOCK || h->rate <= 0 ||
+	(uint64_t) h->nblocks * SPILLARC_BLOCK < h->nsamples ||
+	(h->nblocks && (uint64_t) (h->nblocks - 1) * SPILLARC_BLOCK >= h->nsamples) ||
+	h->index_off < sizeof(*h) || h->index_off % sizeof(*r->index) ||
+	h->index_off + (uint64_t) h->nblocks * sizeof(*r->index) > r->size) {
+	spillarc_close(r);
+	return NULL;
+    }
+    r->index = (const uint32_t *) (r->map + h->index_off);
+    return r;
+}
+
+/**@brief Decode the next samples of an archive.
+ *
+ * @param r archive
+ * @param out samples decoded
+ * @param max no. of samples to decode at most
+ *
+ * @return no. of samples decoded, 0 at the end of the archive, -1 if the
+ * archive is corrupt
+ */
+int spillarc_read(spillarc_reader * r, short *out, int max)
+{
+    const struct spillarc_header *h = r->hdr;
+    const unsigned char *end;
+    int n, done = 0;
+
+    while (done < max) {
+	if (r->cur_pos == r->cur_len) {
+	    if (r->blk == h->nblocks)
+		break;
+	    end = r->map + ((r->blk + 1 < h->nblocks) ? r->index[r->blk + 1] : h->index_off);
+	    if (r->index[r->blk] < sizeof(*h) || end > r->map + h->index_off ||
+		r->map + r->index[r->blk] >= end)
+		return -1;
+	    r->cur_len = (h->nsamples - (uint64_t) r->blk * SPILLARC_BLOCK < SPILLARC_BLOCK) ?
+		h->nsamples - (uint64_t) r->blk * SPILLARC_BLOCK : SPILLARC_BLOCK;
+	    r->cur_pos = 0;
+	    if (decode_block(r->map + r->index[r->blk], end, r->cur_len, r->cur))
+		return -1;
+	    r->blk++;
+	}
+	n = (r->cur_len - r->cur_pos < max - done) ? r->cur_len - r->cur_pos : max - done;
+	memcpy(out + done, r->cur + r->cur_pos, n * sizeof(*out));
+	r->cur_pos += n;
+	done += n;
+    }
+    return done;
+}
+
+/**@brief Go to a sample of an archive.
+ *
+ * Only the block of the sample is decoded, found with the index.
+ *
+ * @param r archive
+ * @param sample sample no. to read next
+ *
+ * @return 0 if successful else -1 if past the end or corrupt
+ */
+int spillarc_seek(spillarc_reader * r, uint64_t sample)
+{
+    short dummy[SPILLARC_BLOCK];
+
+    if (sample > r->hdr->nsamples)
+	return -1;
+    r->blk = sample / SPILLARC_BLOCK;
+    r->cur_pos = r->cur_len = 0;
+    return (spillarc_read(r, dummy, sample % SPILLARC_BLOCK) < 0) ? -1 : 0;
+}
+
+/**@brief Unmap an archive.
+ *
+ * @param r archive
+ */
+void spillarc_close(spillarc_reader * r)
+{
+    if (r) {
+	munmap((void *) r->map, r->size);
+	free(r);
+    }
+}